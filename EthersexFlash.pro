@@ -11,14 +11,12 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = EthersexFlash
 TEMPLATE = app
 
+include(qtftp.pri)
 
 SOURCES += main.cpp\
-        mainwindow.cpp \
-    qtftp.cpp
+        mainwindow.cpp
 
-HEADERS  += mainwindow.h \
-    qtftp.h \
-    qendian.h
+HEADERS  += mainwindow.h
 
 FORMS    += mainwindow.ui
 
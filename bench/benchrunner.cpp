@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "benchrunner.h"
+#include <QCoreApplication>
+#include <QMap>
+#include <QTimer>
+#include <stdio.h>
+#include <algorithm>
+
+#define BENCH_FILE "bench.bin"
+#define BENCH_SIDE_FILE "side.bin"
+
+BenchRunner::BenchRunner(QTftpSessionManager *manager, LoopbackPeer *peer, QTextStream *out, QObject *parent) :
+    QObject(parent),
+    m_manager(manager),
+    m_peer(peer),
+    m_out(out),
+    m_current(-1),
+    m_session(-1),
+    m_sideSession(-1),
+    m_sideElapsed(0),
+    m_error(false),
+    m_failed(0),
+    m_maxRetransmits(-1),
+    m_abortBlock(0),
+    m_pipeDuration(2000),
+    m_pipe(NULL)
+{
+    connect(m_manager, SIGNAL(sessionFinished(int,bool,QString)), this, SLOT(sessionFinished(int,bool,QString)));
+}
+
+void BenchRunner::addCase(BenchRunner::Direction direction, qint64 size, int runs)
+{
+    for (int i = 0; i < runs; i++) {
+        Run run;
+        run.direction = direction;
+        run.size = size;
+        run.run = i + 1;
+        run.elapsed = 0;
+        run.retransmits = 0;
+        run.dropped = 0;
+        run.ok = false;
+        m_runs.append(run);
+    }
+}
+
+void BenchRunner::setAbortBlock(quint64 block)
+{
+    m_abortBlock = block;
+    m_peer->setAbortBlock(block);
+}
+
+void BenchRunner::start()
+{
+    *m_out << "direction\tbytes\trun\tmilliseconds\tKiB/s\tretransmits\tdropped\tresult" << endl;
+    QTimer::singleShot(0, this, SLOT(runNext()));
+}
+
+int BenchRunner::exitCode() const
+{
+    return m_failed > 0 ? 1 : 0;
+}
+
+QByteArray BenchRunner::image(qint64 size)
+{
+    if (!m_images.contains(size)) {
+        QByteArray data;
+        data.resize(size);
+        for (qint64 i = 0; i < size; i++)
+            data[(int)i] = (char)(qrand() & 0xff);
+        m_images.insert(size, data);
+    }
+    return m_images.value(size);
+}
+
+bool BenchRunner::startPipe(const QByteArray &data)
+{
+    if (m_pipe != NULL) {
+        m_pipe->close();
+        m_pipe->deleteLater();
+        m_pipe = NULL;
+    }
+    m_pipeWriter.finish();
+    const int descriptor = m_pipeWriter.open(data, m_pipeDuration);
+    if (descriptor < 0)
+        return false;
+    m_pipe = new QTftpPipeReader(descriptor, this);
+    return m_pipe->open(QIODevice::ReadOnly);
+}
+
+void BenchRunner::runNext()
+{
+    m_current++;
+    if (m_current >= m_runs.size()) {
+        printSummary();
+        QCoreApplication::exit(exitCode());
+        return;
+    }
+    const Run &run = m_runs.at(m_current);
+    m_peer->reset();
+    m_peer->resetCounters();
+    const QByteArray data = image(run.size);
+    m_timer.start();
+    if (run.direction == Put) {
+        m_peer->setFile(BENCH_FILE, QByteArray());
+        m_session = m_manager->put("127.0.0.1", data, BENCH_FILE, m_peer->port());
+    } else if (run.direction == Pipe) {
+        m_peer->setFile(BENCH_FILE, QByteArray());
+        m_peer->setFile(BENCH_SIDE_FILE, QByteArray());
+        if (!startPipe(data)) {
+            report(m_runs.at(m_current), tr("Unable to create a pipe"));
+            QTimer::singleShot(0, this, SLOT(runNext()));
+            return;
+        }
+        m_session = m_manager->put("127.0.0.1", m_pipe, BENCH_FILE, m_peer->port());
+        if (m_session >= 0)
+            m_sideSession = m_manager->put("127.0.0.1", data, BENCH_SIDE_FILE, m_peer->port());
+        m_sideError = m_sideSession < 0 ? tr("Unable to start the put alongside") : QString();
+    } else {
+        m_peer->setFile(BENCH_FILE, data);
+        if (m_abortBlock > 0) {
+            /* A file, so that the download is preallocated if the peer sends tsize */
+            if (!m_file.isOpen() && !m_file.open()) {
+                report(m_runs.at(m_current), tr("Unable to create a temporary file"));
+                QTimer::singleShot(0, this, SLOT(runNext()));
+                return;
+            }
+            m_file.resize(0);
+            m_file.seek(0);
+            m_session = m_manager->get("127.0.0.1", BENCH_FILE, &m_file, m_peer->port());
+        } else {
+            m_buffer.close();
+            m_buffer.setData(QByteArray());
+            m_buffer.open(QIODevice::WriteOnly);
+            m_session = m_manager->get("127.0.0.1", BENCH_FILE, &m_buffer, m_peer->port());
+        }
+    }
+    if (m_session < 0) {
+        report(m_runs.at(m_current), tr("Unable to start the transfer"));
+        QTimer::singleShot(0, this, SLOT(runNext()));
+    }
+}
+
+void BenchRunner::sessionFinished(int id, bool error, const QString &message)
+{
+    if (id == m_sideSession) {
+        m_sideSession = -1;
+        m_sideElapsed = m_timer.elapsed();
+        m_sideError = error ? tr("Put alongside failed: ") + message : QString();
+        if (m_session < 0)
+            finishRun(m_error, m_message);
+        return;
+    }
+    if (id != m_session)
+        return;
+    m_session = -1;
+    m_runs[m_current].elapsed = m_timer.elapsed();
+    m_error = error;
+    m_message = message;
+    /* A pipe run is over once the put alongside is done as well */
+    if (m_sideSession < 0)
+        finishRun(error, message);
+}
+
+void BenchRunner::finishRun(bool error, const QString &message)
+{
+    Run &run = m_runs[m_current];
+    const LoopbackCounters &counters = m_peer->counters();
+    run.retransmits = run.direction == Get ? counters.peerRetransmits : counters.clientRetransmits;
+    run.dropped = counters.dropped;
+    QString text = message;
+    if (run.direction == Get && m_abortBlock > 0) {
+        /* The tail of a failed download must not be left behind as zeros */
+        m_file.flush();
+        m_file.seek(0);
+        const QByteArray received = m_file.readAll();
+        run.ok = error && received.size() < run.size && received == m_images.value(run.size).left(received.size());
+        if (!error)
+            text = tr("Not aborted");
+        else if (!run.ok)
+            text = tr("%1 bytes left behind after an abort").arg(received.size());
+    } else if (!error) {
+        const QByteArray &expected = m_images.value(run.size);
+        const QByteArray received = run.direction == Get ? m_buffer.data() : m_peer->file(BENCH_FILE);
+        run.ok = received == expected;
+        if (!run.ok)
+            text = tr("Image corrupted");
+    }
+    if (run.ok && run.direction == Pipe) {
+        /* Reading the pipe must not hold up the other sessions of the event loop */
+        if (!m_sideError.isEmpty())
+            text = m_sideError;
+        else if (m_peer->file(BENCH_SIDE_FILE) != m_images.value(run.size))
+            text = tr("Image put alongside corrupted");
+        else if (m_sideElapsed * 2 > run.elapsed)
+            text = tr("Put alongside took %1 of %2 ms").arg(m_sideElapsed).arg(run.elapsed);
+        else
+            text = QString();
+        run.ok = text.isEmpty();
+    }
+    if (run.ok && m_maxRetransmits >= 0 && run.retransmits > m_maxRetransmits) {
+        run.ok = false;
+        text = tr("%1 retransmissions, at most %2 expected").arg(run.retransmits).arg(m_maxRetransmits);
+    }
+    report(run, text);
+    if (m_pipe != NULL)
+        m_pipe->close();
+    m_pipeWriter.finish();
+    /* Let the manager clean up the session first */
+    QTimer::singleShot(0, this, SLOT(runNext()));
+}
+
+void BenchRunner::report(const BenchRunner::Run &run, const QString &message)
+{
+    if (!run.ok)
+        m_failed++;
+    const double kibPerSecond = run.elapsed > 0 ? run.size * 1000.0 / 1024.0 / run.elapsed : 0;
+    QString text = message;
+    text.replace("\t", " ");
+    text.replace("\n", " ");
+    *m_out << directionName(run.direction) << '\t'
+           << run.size << '\t'
+           << run.run << '\t'
+           << run.elapsed << '\t'
+           << QString::number(kibPerSecond, 'f', 1) << '\t'
+           << run.retransmits << '\t'
+           << run.dropped << '\t'
+           << (run.ok ? "ok" : text) << endl;
+}
+
+const char *BenchRunner::directionName(BenchRunner::Direction direction)
+{
+    /* Four letters each, printSummary() relies on it */
+    switch (direction) {
+    case Put:
+        return "put";
+    case Get:
+        return "get";
+    default:
+        return "pipe";
+    }
+}
+
+void BenchRunner::printSummary()
+{
+    /* Median time and total retransmissions per direction and size */
+    QMap<QString, QList<qint64> > times;
+    QMap<QString, qint64> retransmits;
+    for (int i = 0; i < m_runs.size(); i++) {
+        const Run &run = m_runs.at(i);
+        if (!run.ok)
+            continue;
+        const QString key = QString("%1 %2").arg(directionName(run.direction)).arg(run.size, 10);
+        times[key].append(run.elapsed);
+        retransmits[key] += run.retransmits;
+    }
+    QTextStream err(stderr);
+    QMap<QString, QList<qint64> >::iterator it;
+    for (it = times.begin(); it != times.end(); ++it) {
+        QList<qint64> elapsed = it.value();
+        std::sort(elapsed.begin(), elapsed.end());
+        const qint64 median = elapsed.at(elapsed.size() / 2);
+        const qint64 size = it.key().mid(4).trimmed().toLongLong();
+        err << it.key() << " bytes: median " << median << " ms, "
+            << QString::number(median > 0 ? size * 1000.0 / 1024.0 / median : 0, 'f', 1) << " KiB/s, "
+            << retransmits.value(it.key()) << " retransmits in " << elapsed.size() << " runs" << endl;
+    }
+    err << tr("%1 runs, %2 failed").arg(m_runs.size()).arg(m_failed) << endl;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Runs get and put transfers against a LoopbackPeer one after another and
+ * writes one tab separated line per run: how long it took, the goodput and
+ * how many blocks had to be sent again. Every transfer is checked against
+ * the image it started with. A pipe run puts an image that trickles in
+ * through a pipe while a put of the same image runs alongside, which has
+ * to finish long before the pipe does.
+ *
+ */
+
+#ifndef BENCHRUNNER_H
+#define BENCHRUNNER_H
+
+#include <QObject>
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include "qtftpsessionmanager.h"
+#include "loopbackpeer.h"
+#include "pipewriter.h"
+#include "qtftppipereader.h"
+
+class BenchRunner : public QObject
+{
+    Q_OBJECT
+public:
+    enum Direction {
+        Put,
+        Get,
+        Pipe
+    };
+
+    BenchRunner(QTftpSessionManager *manager, LoopbackPeer *peer, QTextStream *out, QObject *parent = 0);
+
+    void addCase(Direction direction, qint64 size, int runs);
+    /* A run with more retransmissions fails, -1 (the default) for no limit */
+    void setMaxRetransmits(qint64 count) {
+        m_maxRetransmits = count;
+    }
+    /*
+     * Gets are aborted by the peer at this block and go to a file instead.
+     * A run passes if it fails and the file holds no more than arrived.
+     */
+    void setAbortBlock(quint64 block);
+    /* How long the image of a pipe run takes to trickle in, in ms */
+    void setPipeDuration(int duration) {
+        m_pipeDuration = duration;
+    }
+    void start();
+    int exitCode() const;
+    void printSummary();
+
+private slots:
+    void runNext();
+    void sessionFinished(int id, bool error, const QString &message);
+
+private:
+    struct Run {
+        Direction direction;
+        qint64 size;
+        int run;
+        qint64 elapsed;
+        qint64 retransmits;
+        qint64 dropped;
+        bool ok;
+    };
+    QByteArray image(qint64 size);
+    bool startPipe(const QByteArray &data);
+    void finishRun(bool error, const QString &message);
+    void report(const Run &run, const QString &message);
+    static const char *directionName(Direction direction);
+
+    QTftpSessionManager *m_manager;
+    LoopbackPeer *m_peer;
+    QTextStream *m_out;
+    QList<Run> m_runs;
+    int m_current;
+    int m_session;
+    /* The put alongside a pipe run, and when it finished */
+    int m_sideSession;
+    qint64 m_sideElapsed;
+    QString m_sideError;
+    /* Result of m_session until the side session is done as well */
+    bool m_error;
+    QString m_message;
+    QElapsedTimer m_timer;
+    QBuffer m_buffer;
+    QTemporaryFile m_file;
+    QHash<qint64, QByteArray> m_images;
+    int m_failed;
+    qint64 m_maxRetransmits;
+    quint64 m_abortBlock;
+    int m_pipeDuration;
+    PipeWriter m_pipeWriter;
+    QTftpPipeReader *m_pipe;
+};
+
+#endif // BENCHRUNNER_H
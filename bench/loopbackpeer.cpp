@@ -0,0 +1,505 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "loopbackpeer.h"
+#include <QtGlobal>
+#include <stdlib.h>
+
+/* Sessions the client walked away from are dropped after this many timeouts */
+#define LOOPBACK_MAX_RETRIES 10
+
+static inline quint16 read16(const QByteArray &data, int offset)
+{
+    return ((quint16)(uchar)data.at(offset) << 8) | (uchar)data.at(offset+1);
+}
+
+static inline void append16(QByteArray &data, quint16 value)
+{
+    data.append((char)(value >> 8));
+    data.append((char)(value & 0xff));
+}
+
+/* Returns the string starting at *offset and moves past it, or sets *ok to false */
+static QByteArray readString(const QByteArray &data, int *offset, bool *ok)
+{
+    int end = data.indexOf('\0', *offset);
+    if (end < 0) {
+        *ok = false;
+        return QByteArray();
+    }
+    QByteArray result = data.mid(*offset, end - *offset);
+    *offset = end + 1;
+    return result;
+}
+
+LoopbackPeer::LoopbackPeer(QObject *parent) :
+    QObject(parent),
+    m_socket(NULL),
+    m_optionsEnabled(false),
+    m_maxBlockSize(65464),
+    m_maxWindowSize(64),
+    m_blockWrap(0),
+    m_timeout(200),
+    m_abortBlock(0),
+    m_queueTimer(new QTimer(this)),
+    m_retransmitTimer(new QTimer(this)),
+    m_rxLevel(0),
+    m_rxDrainedAt(0),
+    m_acks(0)
+{
+    m_queueTimer->setSingleShot(true);
+    connect(m_queueTimer, SIGNAL(timeout()), this, SLOT(deliverDueDatagrams()));
+    connect(m_retransmitTimer, SIGNAL(timeout()), this, SLOT(retransmitDue()));
+    m_clock.start();
+}
+
+bool LoopbackPeer::listen()
+{
+    if (m_socket == NULL) {
+        m_socket = new QUdpSocket(this);
+        connect(m_socket, SIGNAL(readyRead()), this, SLOT(readPendingDatagrams()));
+    }
+    return m_socket->bind(QHostAddress::LocalHost, 0);
+}
+
+quint16 LoopbackPeer::port() const
+{
+    return m_socket != NULL ? m_socket->localPort() : 0;
+}
+
+void LoopbackPeer::setFile(const QString &name, const QByteArray &data)
+{
+    m_files.insert(name, data);
+}
+
+void LoopbackPeer::resetCounters()
+{
+    m_counters = LoopbackCounters();
+}
+
+void LoopbackPeer::reset()
+{
+    m_sessions.clear();
+    m_queue.clear();
+    m_queueTimer->stop();
+    m_retransmitTimer->stop();
+    m_rxLevel = 0;
+    m_acks = 0;
+}
+
+double LoopbackPeer::random()
+{
+    return qrand() / (RAND_MAX + 1.0);
+}
+
+quint16 LoopbackPeer::wireBlock(quint64 block) const
+{
+    if (m_blockWrap == 0 || block == 0)
+        return (quint16) block;
+    return (quint16) ((block - 1) % 0xffff + 1);
+}
+
+qint64 LoopbackPeer::blockDistance(quint16 block, quint64 reference) const
+{
+    /* How far block is ahead of reference, negative if behind */
+    if (m_blockWrap != 0 && block == 0)
+        return -(qint64) reference;
+    const qint64 cycle = m_blockWrap == 0 ? 0x10000 : 0xffff;
+    qint64 distance = ((qint64) block - wireBlock(reference)) % cycle;
+    if (distance < 0)
+        distance += cycle;
+    return distance >= cycle / 2 ? distance - cycle : distance;
+}
+
+QString LoopbackPeer::sessionKey(const QHostAddress &host, quint16 port)
+{
+    return host.toString() + ":" + QString::number(port);
+}
+
+void LoopbackPeer::readPendingDatagrams()
+{
+    while (m_socket->hasPendingDatagrams()) {
+        QByteArray data;
+        data.resize(m_socket->pendingDatagramSize());
+        QHostAddress host;
+        quint16 port;
+        qint64 size = m_socket->readDatagram(data.data(), data.size(), &host, &port);
+        if (size < 0)
+            break;
+        data.resize(size);
+        impair(false, data, host, port);
+    }
+}
+
+void LoopbackPeer::impair(bool outgoing, const QByteArray &data, const QHostAddress &host, quint16 port)
+{
+    if (outgoing) {
+        m_counters.datagramsOut++;
+    } else {
+        m_counters.datagramsIn++;
+        if (data.size() >= 4 && read16(data, 0) == 3) {
+            QHash<QString, Session>::iterator it = m_sessions.find(sessionKey(host, port));
+            if (it != m_sessions.end()) {
+                const quint16 block = read16(data, 2);
+                const quint16 ahead = block - it->highestSent;
+                if (ahead != 0 && ahead < 0x8000)
+                    it->highestSent = block;
+                else
+                    m_counters.clientRetransmits++;
+            }
+        }
+    }
+    const qint64 now = m_clock.elapsed();
+    if (!outgoing && m_impairment.rxBuffer > 0) {
+        m_rxLevel = qMax(0.0, m_rxLevel - (now - m_rxDrainedAt) * m_impairment.rxRate);
+        m_rxDrainedAt = now;
+        if (m_rxLevel + 1 > m_impairment.rxBuffer) {
+            m_counters.dropped++;
+            return;
+        }
+        m_rxLevel += 1;
+    }
+    qint64 stall = 0;
+    if (m_impairment.stallAck > 0 && data.size() >= 4 && read16(data, 0) == 4
+            && ++m_acks == m_impairment.stallAck)
+        stall = m_impairment.stallTime;
+    if (random() < m_impairment.loss) {
+        m_counters.dropped++;
+        return;
+    }
+    int copies = 1;
+    if (random() < m_impairment.duplicate) {
+        m_counters.duplicated++;
+        copies++;
+    }
+    for (int i = 0; i < copies; i++) {
+        Datagram datagram;
+        datagram.due = now + m_impairment.delay + stall;
+        if (m_impairment.jitter > 0)
+            datagram.due += (qint64)(random() * (m_impairment.jitter + 1));
+        if (random() < m_impairment.reorder) {
+            /* Hold it back long enough for the following datagrams to overtake it */
+            datagram.due += m_impairment.delay + m_impairment.jitter + 2;
+            m_counters.reordered++;
+        }
+        datagram.outgoing = outgoing;
+        datagram.data = data;
+        datagram.host = host;
+        datagram.port = port;
+        schedule(datagram);
+    }
+}
+
+void LoopbackPeer::schedule(const Datagram &datagram)
+{
+    const qint64 now = m_clock.elapsed();
+    if (datagram.due <= now && m_queue.isEmpty()) {
+        /* Nothing to wait for, skip the trip through the event loop */
+        if (datagram.outgoing)
+            m_socket->writeDatagram(datagram.data, datagram.host, datagram.port);
+        else
+            process(datagram.data, datagram.host, datagram.port);
+        return;
+    }
+    int i = m_queue.size();
+    while (i > 0 && m_queue.at(i-1).due > datagram.due)
+        i--;
+    m_queue.insert(i, datagram);
+    m_queueTimer->start(qMax<qint64>(0, m_queue.first().due - now));
+}
+
+void LoopbackPeer::deliverDueDatagrams()
+{
+    const qint64 now = m_clock.elapsed();
+    while (!m_queue.isEmpty() && m_queue.first().due <= now) {
+        const Datagram datagram = m_queue.takeFirst();
+        if (datagram.outgoing)
+            m_socket->writeDatagram(datagram.data, datagram.host, datagram.port);
+        else
+            process(datagram.data, datagram.host, datagram.port);
+    }
+    if (!m_queue.isEmpty())
+        m_queueTimer->start(qMax<qint64>(0, m_queue.first().due - m_clock.elapsed()));
+}
+
+void LoopbackPeer::process(const QByteArray &data, const QHostAddress &host, quint16 port)
+{
+    if (data.size() < 4)
+        return;
+    const quint16 opCode = read16(data, 0);
+    if (opCode == 1 || opCode == 2) {
+        handleRequest(opCode == 1, data, host, port);
+        return;
+    }
+    QHash<QString, Session>::iterator it = m_sessions.find(sessionKey(host, port));
+    if (it == m_sessions.end()) {
+        sendError(5, "Unknown transfer ID", host, port);
+        return;
+    }
+    switch (opCode) {
+    case 3:
+        handleData(&it.value(), data);
+        break;
+    case 4:
+        handleAcknowledgment(&it.value(), read16(data, 2));
+        break;
+    case 5:
+        m_sessions.erase(it);
+        break;
+    default:
+        sendError(4, "Illegal TFTP operation", host, port);
+        break;
+    }
+}
+
+void LoopbackPeer::handleRequest(bool reading, const QByteArray &data, const QHostAddress &host, quint16 port)
+{
+    const QString key = sessionKey(host, port);
+    QHash<QString, Session>::iterator it = m_sessions.find(key);
+    if (it != m_sessions.end() && !it->finished && it->reading == reading) {
+        /* The client repeats its request because our answer got lost */
+        if (it->awaitingOptionAck || (!reading && it->expected == 1))
+            answerRequest(&it.value());
+        return;
+    }
+
+    int offset = 2;
+    bool ok = true;
+    const QString file = QString::fromLatin1(readString(data, &offset, &ok));
+    const QByteArray mode = readString(data, &offset, &ok).toLower();
+    if (!ok || file.isEmpty()) {
+        sendError(4, "Malformed request", host, port);
+        return;
+    }
+    if (mode != "octet") {
+        sendError(4, "Transfer mode not supported", host, port);
+        return;
+    }
+    if (reading && !m_files.contains(file)) {
+        sendError(1, "File not found", host, port);
+        return;
+    }
+
+    Session session;
+    session.host = host;
+    session.port = port;
+    session.reading = reading;
+    session.file = file;
+    if (reading)
+        session.data = m_files.value(file);
+    session.blockSize = 512;
+    session.windowSize = 1;
+    while (m_optionsEnabled && offset < data.size()) {
+        const QByteArray name = readString(data, &offset, &ok).toLower();
+        const QByteArray value = readString(data, &offset, &ok);
+        if (!ok)
+            break;
+        bool isNumber;
+        const uint number = value.toUInt(&isNumber);
+        if (!isNumber)
+            continue;
+        if (name == "blksize" && number >= 8) {
+            session.blockSize = qMin<uint>(number, m_maxBlockSize);
+            session.optionAck.append("blksize").append('\0');
+            session.optionAck.append(QByteArray::number(session.blockSize)).append('\0');
+        } else if (name == "windowsize" && number >= 1) {
+            session.windowSize = qMin<uint>(number, m_maxWindowSize);
+            session.optionAck.append("windowsize").append('\0');
+            session.optionAck.append(QByteArray::number(session.windowSize)).append('\0');
+        } else if (name == "tsize") {
+            session.optionAck.append("tsize").append('\0');
+            session.optionAck.append(reading ? QByteArray::number(session.data.size()) : value).append('\0');
+        } else if (name == "timeout" && number >= 1 && number <= 255) {
+            session.optionAck.append("timeout").append('\0');
+            session.optionAck.append(value).append('\0');
+        }
+    }
+    session.expected = 1;
+    session.base = 1;
+    session.next = 1;
+    session.lastBlock = session.data.size() / session.blockSize + 1;
+    session.highestSent = 0;
+    session.sinceAck = 0;
+    session.gapAcked = false;
+    session.awaitingOptionAck = reading && !session.optionAck.isEmpty();
+    session.finished = false;
+    session.lastSent = m_clock.elapsed();
+    session.retries = 0;
+    it = m_sessions.insert(key, session);
+    answerRequest(&it.value());
+    if (reading && !m_retransmitTimer->isActive())
+        m_retransmitTimer->start(qMax(5, m_timeout / 4));
+}
+
+void LoopbackPeer::answerRequest(Session *session)
+{
+    if (!session->optionAck.isEmpty() && (session->awaitingOptionAck || !session->reading))
+        sendOptionAcknowledgment(session);
+    else if (session->reading)
+        sendWindow(session, session->base);
+    else
+        sendAcknowledgment(session, 0);
+}
+
+void LoopbackPeer::handleData(Session *session, const QByteArray &data)
+{
+    if (session->reading)
+        return;
+    const quint16 block = read16(data, 2);
+    const qint64 distance = blockDistance(block, session->expected);
+    if (distance == 0 && !session->finished) {
+        session->data.append(data.constData() + 4, data.size() - 4);
+        session->expected++;
+        session->sinceAck++;
+        session->gapAcked = false;
+        if (data.size() - 4 < session->blockSize) {
+            /* Like the bootloader, flash the image once the last block is in */
+            session->finished = true;
+            m_files.insert(session->file, session->data);
+            session->data.clear();
+        }
+        if (session->finished || session->sinceAck >= session->windowSize) {
+            sendAcknowledgment(session, block);
+            session->sinceAck = 0;
+        }
+    } else if (distance <= 0) {
+        /* Only the last block we have makes the sender think its ACK got lost */
+        if (distance == -1) {
+            sendAcknowledgment(session, block);
+            session->sinceAck = 0;
+        }
+    } else if (!session->gapAcked) {
+        /* Report the gap once, RFC 7440 */
+        sendAcknowledgment(session, wireBlock(session->expected - 1));
+        session->gapAcked = true;
+        session->sinceAck = 0;
+    }
+}
+
+void LoopbackPeer::handleAcknowledgment(Session *session, quint16 block)
+{
+    if (!session->reading || session->finished)
+        return;
+    session->retries = 0;
+    if (session->awaitingOptionAck) {
+        if (block == 0) {
+            session->awaitingOptionAck = false;
+            sendWindow(session, session->base);
+        }
+        return;
+    }
+    const qint64 acked = blockDistance(block, session->base - 1);
+    const qint64 inFlight = session->next - session->base;
+    if (acked == 0) {
+        /* The client reports a gap, go back to the first block it misses */
+        if (inFlight > 0)
+            sendWindow(session, session->base);
+        return;
+    }
+    if (acked < 0 || acked > inFlight)
+        return;
+    session->base += acked;
+    if (session->base > session->lastBlock) {
+        session->finished = true;
+        return;
+    }
+    sendWindow(session, session->next);
+}
+
+void LoopbackPeer::sendWindow(Session *session, quint64 from)
+{
+    quint64 block = from;
+    for (; block < session->base + session->windowSize && block <= session->lastBlock; block++) {
+        if (m_abortBlock > 0 && block >= m_abortBlock) {
+            /* Like a bootloader that runs out of flash, the session is over */
+            sendError(0, "Aborted", session->host, session->port);
+            session->finished = true;
+            break;
+        }
+        if (block < session->next)
+            m_counters.peerRetransmits++;
+        sendData(session, block);
+    }
+    if (block > session->next)
+        session->next = block;
+    session->lastSent = m_clock.elapsed();
+}
+
+void LoopbackPeer::sendData(Session *session, quint64 block)
+{
+    const qint64 offset = (qint64)(block - 1) * session->blockSize;
+    const int size = (int)qMin<qint64>(session->blockSize, session->data.size() - offset);
+    QByteArray packet;
+    packet.reserve(4 + size);
+    append16(packet, 3);
+    append16(packet, wireBlock(block));
+    packet.append(session->data.constData() + offset, size);
+    impair(true, packet, session->host, session->port);
+}
+
+void LoopbackPeer::sendAcknowledgment(Session *session, quint16 block)
+{
+    QByteArray packet;
+    append16(packet, 4);
+    append16(packet, block);
+    impair(true, packet, session->host, session->port);
+}
+
+void LoopbackPeer::sendOptionAcknowledgment(Session *session)
+{
+    QByteArray packet;
+    append16(packet, 6);
+    packet.append(session->optionAck);
+    impair(true, packet, session->host, session->port);
+    session->lastSent = m_clock.elapsed();
+}
+
+void LoopbackPeer::sendError(quint16 code, const char *message, const QHostAddress &host, quint16 port)
+{
+    QByteArray packet;
+    append16(packet, 5);
+    append16(packet, code);
+    packet.append(message).append('\0');
+    impair(true, packet, host, port);
+}
+
+void LoopbackPeer::retransmitDue()
+{
+    const qint64 now = m_clock.elapsed();
+    bool reading = false;
+    QHash<QString, Session>::iterator it = m_sessions.begin();
+    while (it != m_sessions.end()) {
+        Session *session = &it.value();
+        if (!session->reading || session->finished) {
+            ++it;
+            continue;
+        }
+        if (now - session->lastSent >= m_timeout) {
+            if (++session->retries > LOOPBACK_MAX_RETRIES) {
+                it = m_sessions.erase(it);
+                continue;
+            }
+            answerRequest(session);
+            session->lastSent = now;
+        }
+        reading = true;
+        ++it;
+    }
+    if (!reading)
+        m_retransmitTimer->stop();
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * LoopbackPeer stands in for the TFTP server of an Ethersex bootloader on
+ * 127.0.0.1. It stores what is written to it and serves it back on a read
+ * request. Every datagram, in both directions, passes an impairment stage
+ * first, which can drop, duplicate, delay and reorder it, and overrun a
+ * small receive buffer like the one of an ENC28J60. Randomness comes
+ * from qrand(), so a run is repeatable with the same qsrand() seed.
+ *
+ */
+
+#ifndef LOOPBACKPEER_H
+#define LOOPBACKPEER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QTimer>
+#include <QUdpSocket>
+
+struct LoopbackImpairment {
+    LoopbackImpairment() :
+        loss(0), duplicate(0), reorder(0), delay(0), jitter(0), rxBuffer(0), rxRate(1), stallAck(0), stallTime(0) {}
+    /* Probabilities (0..1) applied to every datagram */
+    double loss;
+    double duplicate;
+    double reorder;
+    /* One way delay and the random amount added on top, in ms */
+    int delay;
+    int jitter;
+    /*
+     * Datagrams to the peer that fit into its receive buffer, which drains
+     * rxRate datagrams per ms. Whatever arrives while it is full is dropped.
+     * 0 for an unlimited buffer.
+     */
+    int rxBuffer;
+    double rxRate;
+    /*
+     * The stallAck-th ACK of a transfer, whichever side sends it, is held
+     * back stallTime ms. Longer than the other side's timeout, it forces a
+     * spurious retransmission. 0 for none.
+     */
+    int stallAck;
+    int stallTime;
+};
+
+struct LoopbackCounters {
+    LoopbackCounters() :
+        datagramsIn(0), datagramsOut(0), dropped(0), duplicated(0), reordered(0),
+        clientRetransmits(0), peerRetransmits(0) {}
+    qint64 datagramsIn;
+    qint64 datagramsOut;
+    qint64 dropped;
+    qint64 duplicated;
+    qint64 reordered;
+    /* DATA blocks the client sent again, counted before the impairment stage */
+    qint64 clientRetransmits;
+    /* DATA blocks the peer had to send again while serving a read request */
+    qint64 peerRetransmits;
+};
+
+class LoopbackPeer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LoopbackPeer(QObject *parent = 0);
+
+    /* Binds to an ephemeral port on 127.0.0.1 */
+    bool listen();
+    quint16 port() const;
+
+    void setImpairment(const LoopbackImpairment &impairment) {
+        m_impairment = impairment;
+    }
+    /* Off like in the bootloader, which only knows plain RFC 1350 */
+    void setOptionsEnabled(bool enabled) {
+        m_optionsEnabled = enabled;
+    }
+    void setMaxBlockSize(quint16 size) {
+        m_maxBlockSize = size;
+    }
+    void setMaxWindowSize(quint16 size) {
+        m_maxWindowSize = size;
+    }
+    /* Block number following 65535, 0 or 1 */
+    void setBlockWrap(quint16 block) {
+        m_blockWrap = block;
+    }
+    /* Fixed timeout the peer retransmits with while serving a read request, in ms */
+    void setRetransmitTimeout(int timeout) {
+        m_timeout = timeout;
+    }
+    /* A read request gets an ERROR instead of this block, 0 (the default) to serve it all */
+    void setAbortBlock(quint64 block) {
+        m_abortBlock = block;
+    }
+
+    /* Files served on a read request and replaced by a complete write request */
+    void setFile(const QString &name, const QByteArray &data);
+    QByteArray file(const QString &name) const {
+        return m_files.value(name);
+    }
+
+    const LoopbackCounters &counters() const {
+        return m_counters;
+    }
+    void resetCounters();
+    /* Forgets all sessions, in flight datagrams are dropped */
+    void reset();
+
+private slots:
+    void readPendingDatagrams();
+    void deliverDueDatagrams();
+    void retransmitDue();
+
+private:
+    struct Datagram {
+        qint64 due;
+        bool outgoing;
+        QByteArray data;
+        QHostAddress host;
+        quint16 port;
+    };
+    struct Session {
+        QHostAddress host;
+        quint16 port;
+        bool reading;
+        QString file;
+        QByteArray data;
+        quint16 blockSize;
+        quint16 windowSize;
+        QByteArray optionAck;
+        /* 64 bit block numbers, the wire only carries wireBlock() of them */
+        quint64 expected;
+        quint64 base;
+        quint64 next;
+        quint64 lastBlock;
+        quint16 highestSent;
+        int sinceAck;
+        bool gapAcked;
+        bool awaitingOptionAck;
+        bool finished;
+        qint64 lastSent;
+        int retries;
+    };
+
+    void impair(bool outgoing, const QByteArray &data, const QHostAddress &host, quint16 port);
+    void schedule(const Datagram &datagram);
+    void process(const QByteArray &data, const QHostAddress &host, quint16 port);
+    void handleRequest(bool reading, const QByteArray &data, const QHostAddress &host, quint16 port);
+    void answerRequest(Session *session);
+    void handleData(Session *session, const QByteArray &data);
+    void handleAcknowledgment(Session *session, quint16 block);
+    void sendWindow(Session *session, quint64 from);
+    void sendData(Session *session, quint64 block);
+    void sendAcknowledgment(Session *session, quint16 block);
+    void sendOptionAcknowledgment(Session *session);
+    void sendError(quint16 code, const char *message, const QHostAddress &host, quint16 port);
+    quint16 wireBlock(quint64 block) const;
+    qint64 blockDistance(quint16 block, quint64 reference) const;
+    static double random();
+    static QString sessionKey(const QHostAddress &host, quint16 port);
+
+private:
+    QUdpSocket *m_socket;
+    LoopbackImpairment m_impairment;
+    LoopbackCounters m_counters;
+    bool m_optionsEnabled;
+    quint16 m_maxBlockSize;
+    quint16 m_maxWindowSize;
+    quint16 m_blockWrap;
+    int m_timeout;
+    quint64 m_abortBlock;
+
+    QHash<QString, QByteArray> m_files;
+    QHash<QString, Session> m_sessions;
+
+    /* Impaired datagrams ordered by due time */
+    QList<Datagram> m_queue;
+    QTimer *m_queueTimer;
+    QTimer *m_retransmitTimer;
+    QElapsedTimer m_clock;
+    /* Fill level of the receive buffer and when it was last drained */
+    double m_rxLevel;
+    qint64 m_rxDrainedAt;
+    /* ACKs seen since the last reset(), for stallAck */
+    int m_acks;
+};
+
+#endif // LOOPBACKPEER_H
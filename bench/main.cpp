@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QStringList>
+#include <QTextStream>
+#include <stdio.h>
+#include "benchrunner.h"
+#include "loopbackpeer.h"
+#include "multicastrunner.h"
+#include "timerbench.h"
+#include "qtftpsessionmanager.h"
+
+static void usage(QTextStream &err)
+{
+    err << "Usage: tftpbench [options]" << endl
+        << endl
+        << "Transfers images to and from a stand-in for the Ethersex bootloader" << endl
+        << "on 127.0.0.1 and prints one tab separated result line per run." << endl
+        << "Exits with 0 if every transfer arrived intact, 1 otherwise." << endl
+        << endl
+        << "Options:" << endl
+        << "  --direction <put|get|both|pipe>" << endl
+        << "                              transfers to run (default both); pipe puts an image that" << endl
+        << "                              trickles in through a pipe while a put of the same image" << endl
+        << "                              runs alongside, which has to finish in half the time" << endl
+        << "  --pipe-time <ms>            how long the image of a pipe run takes (default 2000)" << endl
+        << "  --sizes <list>              image sizes, k and M suffixes allowed (default 64k,1M,8M)" << endl
+        << "  --runs <n>                  runs per direction and size (default 3)" << endl
+        << "  --seed <n>                  seed for images and impairment (default 1)" << endl
+        << "  --loss <percent>            datagrams dropped, each direction" << endl
+        << "  --duplicate <percent>       datagrams delivered twice" << endl
+        << "  --reorder <percent>         datagrams held back behind later ones" << endl
+        << "  --delay <ms>                one way delay" << endl
+        << "  --jitter <ms>               random delay added on top" << endl
+        << "  --rx-buffer <datagrams>     receive buffer of the peer, what arrives while it is" << endl
+        << "                              full is dropped (default unlimited)" << endl
+        << "  --rx-rate <datagrams/ms>    how fast the peer drains its buffer (default 1)" << endl
+        << "  --stall <ack>:<ms>          hold back the <ack>th ACK of each run, e.g. 20:500 forces a" << endl
+        << "                              spurious timeout on either side" << endl
+        << "  --max-retransmits <n>       fail runs with more retransmissions; with --stall, checks" << endl
+        << "                              that a spurious timeout doesn't start a Sorcerer's" << endl
+        << "                              Apprentice storm (every DATA and ACK sent twice)" << endl
+        << "  --options                   the peer accepts blksize, windowsize, tsize and timeout" << endl
+        << "  --peer-timeout <ms>         peer retransmission timeout on get (default 200)" << endl
+        << "  --abort <block>             the peer aborts gets at that block, which then pass if" << endl
+        << "                              the file holds no more than arrived; with --options" << endl
+        << "                              it has been preallocated with tsize" << endl
+        << "  --blksize <bytes>           block size to request, 512 disables the option" << endl
+        << "  --windowsize <blocks>       window size to request, 1 disables the option" << endl
+        << "  --retries <n>               retransmissions before a transfer fails" << endl
+        << "  --timeout <seconds>         retransmission timeout to agree on" << endl
+        << "  --pace <burst>:<gap>|auto   pace the DATA packets of a window, see QTftp::setPacing()" << endl
+        << "  --block-wrap <0|1>          block number following 65535 on both sides, e.g." << endl
+        << "                              --options --blksize 8 --sizes 1M wraps twice" << endl
+        << "  --multicast <clients>       instead, let that many clients get each image from a" << endl
+        << "                              QTftpServer, first by unicast and then by multicast" << endl
+        << "  --group <address>           multicast group (default 239.255.0.69)" << endl
+        << "  --interface <name>          interface of the group (default lo, which may need" << endl
+        << "                              'ip link set lo multicast on')" << endl
+        << "  --timers <restarts>         instead, compare a QTimer per session with the shared" << endl
+        << "                              timer wheel at 10, 100 and 1000 sessions" << endl;
+}
+
+static qint64 parseSize(QString text, bool *ok)
+{
+    qint64 factor = 1;
+    if (text.endsWith("k", Qt::CaseInsensitive)) {
+        factor = 1024;
+        text.chop(1);
+    } else if (text.endsWith("M")) {
+        factor = 1024 * 1024;
+        text.chop(1);
+    }
+    qint64 size = text.toLongLong(ok) * factor;
+    if (size < 0)
+        *ok = false;
+    return size;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    QTftpSessionManager manager;
+    manager.setMaxConcurrentSessions(1);
+    LoopbackPeer peer;
+    LoopbackImpairment impairment;
+    QString direction = "both";
+    QStringList sizes = QString("64k,1M,8M").split(',');
+    int runs = 3;
+    uint seed = 1;
+    int multicastClients = 0;
+    QHostAddress group("239.255.0.69");
+    QString interfaceName = "lo";
+    int timerRestarts = 0;
+    qint64 maxRetransmits = -1;
+    quint64 abortBlock = 0;
+    int pipeDuration = 2000;
+
+    QStringList args = QCoreApplication::arguments();
+    for (int i = 1; i < args.size(); i++) {
+        QString arg = args.at(i);
+        bool ok = true;
+        if (arg == "--direction" && i+1 < args.size()) {
+            direction = args.at(++i);
+            ok = direction == "put" || direction == "get" || direction == "both" || direction == "pipe";
+        } else if (arg == "--pipe-time" && i+1 < args.size()) {
+            pipeDuration = args.at(++i).toInt(&ok);
+            ok = ok && pipeDuration >= 0;
+        } else if (arg == "--sizes" && i+1 < args.size()) {
+            sizes = args.at(++i).split(',');
+        } else if (arg == "--runs" && i+1 < args.size()) {
+            runs = args.at(++i).toInt(&ok);
+        } else if (arg == "--seed" && i+1 < args.size()) {
+            seed = args.at(++i).toUInt(&ok);
+        } else if (arg == "--loss" && i+1 < args.size()) {
+            impairment.loss = args.at(++i).toDouble(&ok) / 100.0;
+        } else if (arg == "--duplicate" && i+1 < args.size()) {
+            impairment.duplicate = args.at(++i).toDouble(&ok) / 100.0;
+        } else if (arg == "--reorder" && i+1 < args.size()) {
+            impairment.reorder = args.at(++i).toDouble(&ok) / 100.0;
+        } else if (arg == "--delay" && i+1 < args.size()) {
+            impairment.delay = args.at(++i).toInt(&ok);
+        } else if (arg == "--jitter" && i+1 < args.size()) {
+            impairment.jitter = args.at(++i).toInt(&ok);
+        } else if (arg == "--rx-buffer" && i+1 < args.size()) {
+            impairment.rxBuffer = args.at(++i).toInt(&ok);
+        } else if (arg == "--rx-rate" && i+1 < args.size()) {
+            impairment.rxRate = args.at(++i).toDouble(&ok);
+        } else if (arg == "--stall" && i+1 < args.size()) {
+            const QString stall = args.at(++i);
+            bool timeOk = false;
+            impairment.stallAck = stall.section(':', 0, 0).toInt(&ok);
+            impairment.stallTime = stall.section(':', 1).toInt(&timeOk);
+            ok = ok && timeOk && impairment.stallAck > 0 && impairment.stallTime >= 0;
+        } else if (arg == "--max-retransmits" && i+1 < args.size()) {
+            maxRetransmits = args.at(++i).toLongLong(&ok);
+            ok = ok && maxRetransmits >= 0;
+        } else if (arg == "--pace" && i+1 < args.size()) {
+            const QString pace = args.at(++i);
+            if (pace == "auto") {
+                manager.setPacing(0, 0, true);
+            } else {
+                bool gapOk = false;
+                const int burst = pace.section(':', 0, 0).toInt(&ok);
+                const int gap = pace.section(':', 1).toInt(&gapOk);
+                ok = ok && gapOk && burst > 0 && gap >= 0;
+                manager.setPacing(burst, gap);
+            }
+        } else if (arg == "--options") {
+            peer.setOptionsEnabled(true);
+        } else if (arg == "--abort" && i+1 < args.size()) {
+            abortBlock = args.at(++i).toULongLong(&ok);
+            ok = ok && abortBlock > 0;
+        } else if (arg == "--peer-timeout" && i+1 < args.size()) {
+            peer.setRetransmitTimeout(args.at(++i).toInt(&ok));
+        } else if (arg == "--blksize" && i+1 < args.size()) {
+            manager.setBlockSize(args.at(++i).toUShort(&ok));
+        } else if (arg == "--windowsize" && i+1 < args.size()) {
+            manager.setWindowSize(args.at(++i).toUShort(&ok));
+        } else if (arg == "--retries" && i+1 < args.size()) {
+            manager.setMaxRetries(args.at(++i).toInt(&ok));
+        } else if (arg == "--timeout" && i+1 < args.size()) {
+            manager.setTimeoutInterval(args.at(++i).toInt(&ok));
+        } else if (arg == "--block-wrap" && i+1 < args.size()) {
+            const quint16 blockWrap = args.at(++i).toUShort(&ok);
+            ok = ok && blockWrap <= 1;
+            manager.setBlockWrap(blockWrap);
+            peer.setBlockWrap(blockWrap);
+        } else if (arg == "--multicast" && i+1 < args.size()) {
+            multicastClients = args.at(++i).toInt(&ok);
+            ok = ok && multicastClients > 0;
+        } else if (arg == "--group" && i+1 < args.size()) {
+            ok = group.setAddress(args.at(++i));
+        } else if (arg == "--interface" && i+1 < args.size()) {
+            interfaceName = args.at(++i);
+        } else if (arg == "--timers" && i+1 < args.size()) {
+            timerRestarts = args.at(++i).toInt(&ok);
+            ok = ok && timerRestarts > 0;
+        } else if (arg == "-h" || arg == "--help") {
+            usage(out);
+            return 0;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            err << "Invalid argument: " << arg << endl;
+            usage(err);
+            return 2;
+        }
+    }
+
+    if (timerRestarts > 0) {
+        qsrand(seed);
+        TimerBench bench(&out);
+        return bench.run(timerRestarts);
+    }
+
+    if (multicastClients > 0) {
+        const QNetworkInterface iface = QNetworkInterface::interfaceFromName(interfaceName);
+        if (!iface.isValid()) {
+            err << "Unknown interface " << interfaceName << endl;
+            return 2;
+        }
+        QTftpServer server;
+        server.setRootDirectory(QDir::tempPath());
+        server.setMulticastGroup(group, TFTP_DEFAULT_MULTICAST_PORT, iface);
+        if (!server.listen(QHostAddress::LocalHost, 0)) {
+            err << "Unable to bind the server" << endl;
+            return 2;
+        }
+        qsrand(seed);
+        MulticastRunner runner(&manager, &server, QDir::tempPath(), iface, &out);
+        for (int i = 0; i < sizes.size(); i++) {
+            bool ok;
+            qint64 size = parseSize(sizes.at(i).trimmed(), &ok);
+            if (!ok) {
+                err << "Invalid size: " << sizes.at(i) << endl;
+                return 2;
+            }
+            runner.addCase(size, multicastClients, runs);
+        }
+        runner.start();
+        return app.exec();
+    }
+
+    if (!peer.listen()) {
+        err << "Unable to bind the loopback peer" << endl;
+        return 2;
+    }
+    peer.setImpairment(impairment);
+    qsrand(seed);
+
+    BenchRunner runner(&manager, &peer, &out);
+    runner.setMaxRetransmits(maxRetransmits);
+    runner.setAbortBlock(abortBlock);
+    runner.setPipeDuration(pipeDuration);
+    /* The pipe and the put alongside it */
+    if (direction == "pipe")
+        manager.setMaxConcurrentSessions(2);
+    for (int i = 0; i < sizes.size(); i++) {
+        bool ok;
+        qint64 size = parseSize(sizes.at(i).trimmed(), &ok);
+        if (!ok) {
+            err << "Invalid size: " << sizes.at(i) << endl;
+            return 2;
+        }
+        if (direction == "pipe")
+            runner.addCase(BenchRunner::Pipe, size, runs);
+        if (direction == "put" || direction == "both")
+            runner.addCase(BenchRunner::Put, size, runs);
+        if (direction == "get" || direction == "both")
+            runner.addCase(BenchRunner::Get, size, runs);
+    }
+    runner.start();
+    return app.exec();
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "multicastrunner.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QMap>
+#include <QTimer>
+#include <stdio.h>
+#include <algorithm>
+
+MulticastRunner::MulticastRunner(QTftpSessionManager *manager, QTftpServer *server, const QString &root,
+                                 const QNetworkInterface &iface, QTextStream *out, QObject *parent) :
+    QObject(parent),
+    m_manager(manager),
+    m_server(server),
+    m_root(root),
+    m_interface(iface),
+    m_out(out),
+    m_current(-1),
+    m_failed(0)
+{
+    connect(m_manager, SIGNAL(sessionFinished(int,bool,QString)), this, SLOT(sessionFinished(int,bool,QString)));
+}
+
+MulticastRunner::~MulticastRunner()
+{
+    qDeleteAll(m_buffers);
+    foreach (qint64 size, m_images.keys())
+        QFile::remove(QDir(m_root).filePath(imageFile(size)));
+}
+
+void MulticastRunner::addCase(qint64 size, int clients, int runs)
+{
+    /* Unicast first, it is what multicast has to beat */
+    for (int mode = 0; mode < 2; mode++) {
+        for (int i = 0; i < runs; i++) {
+            Run run;
+            run.multicast = mode == 1;
+            run.size = size;
+            run.clients = clients;
+            run.run = i + 1;
+            run.elapsed = 0;
+            run.failed = 0;
+            run.ok = false;
+            m_runs.append(run);
+        }
+    }
+}
+
+void MulticastRunner::start()
+{
+    *m_out << "mode\tclients\tbytes\trun\tmilliseconds\tKiB/s\tresult" << endl;
+    QTimer::singleShot(0, this, SLOT(runNext()));
+}
+
+int MulticastRunner::exitCode() const
+{
+    return m_failed > 0 ? 1 : 0;
+}
+
+QString MulticastRunner::imageFile(qint64 size)
+{
+    const QString name = QString("tftpbench-%1.bin").arg(size);
+    if (!m_images.contains(size)) {
+        QByteArray data;
+        data.resize(size);
+        for (qint64 i = 0; i < size; i++)
+            data[(int)i] = (char)(qrand() & 0xff);
+        QFile file(QDir(m_root).filePath(name));
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            file.write(data);
+        m_images.insert(size, data);
+    }
+    return name;
+}
+
+void MulticastRunner::runNext()
+{
+    m_current++;
+    if (m_current >= m_runs.size()) {
+        printSummary();
+        QCoreApplication::exit(exitCode());
+        return;
+    }
+    const Run &run = m_runs.at(m_current);
+    const QString file = imageFile(run.size);
+    m_manager->setMaxConcurrentSessions(run.clients);
+    m_manager->setMulticast(run.multicast, m_interface);
+    m_lastMessage.clear();
+    m_timer.start();
+    for (int i = 0; i < run.clients; i++) {
+        QBuffer *buffer = new QBuffer;
+        buffer->open(QIODevice::ReadWrite);
+        int id = m_manager->get("127.0.0.1", file, buffer, m_server->serverPort());
+        if (id < 0) {
+            delete buffer;
+            m_runs[m_current].failed++;
+            continue;
+        }
+        m_buffers.insert(id, buffer);
+    }
+    if (m_buffers.isEmpty()) {
+        report(m_runs.at(m_current), tr("Unable to start the transfers"));
+        QTimer::singleShot(0, this, SLOT(runNext()));
+    }
+}
+
+void MulticastRunner::sessionFinished(int id, bool error, const QString &message)
+{
+    if (!m_buffers.contains(id))
+        return;
+    Run &run = m_runs[m_current];
+    QBuffer *buffer = m_buffers.take(id);
+    if (error || buffer->data() != m_images.value(run.size)) {
+        run.failed++;
+        m_lastMessage = error ? message : tr("Image corrupted");
+    }
+    delete buffer;
+    if (!m_buffers.isEmpty())
+        return;
+    run.elapsed = m_timer.elapsed();
+    run.ok = run.failed == 0;
+    report(run, m_lastMessage);
+    /* Let the manager clean up the sessions first */
+    QTimer::singleShot(0, this, SLOT(runNext()));
+}
+
+void MulticastRunner::report(const MulticastRunner::Run &run, const QString &message)
+{
+    if (!run.ok)
+        m_failed++;
+    /* What all clients got together */
+    const double kibPerSecond = run.elapsed > 0 ? run.size * run.clients * 1000.0 / 1024.0 / run.elapsed : 0;
+    QString text = message;
+    text.replace("\t", " ");
+    text.replace("\n", " ");
+    *m_out << (run.multicast ? "multicast" : "unicast") << '\t'
+           << run.clients << '\t'
+           << run.size << '\t'
+           << run.run << '\t'
+           << run.elapsed << '\t'
+           << QString::number(kibPerSecond, 'f', 1) << '\t'
+           << (run.ok ? QString("ok") : tr("%1 failed: %2").arg(run.failed).arg(text)) << endl;
+}
+
+void MulticastRunner::printSummary()
+{
+    /* Median time per mode and size */
+    QMap<QString, QList<qint64> > times;
+    for (int i = 0; i < m_runs.size(); i++) {
+        const Run &run = m_runs.at(i);
+        if (!run.ok)
+            continue;
+        const QString key = QString("%1 %2 x %3").arg(run.multicast ? "multicast" : "unicast  ")
+                .arg(run.clients).arg(run.size, 10);
+        times[key].append(run.elapsed);
+    }
+    QTextStream err(stderr);
+    QMap<QString, QList<qint64> >::iterator it;
+    for (it = times.begin(); it != times.end(); ++it) {
+        QList<qint64> elapsed = it.value();
+        std::sort(elapsed.begin(), elapsed.end());
+        err << it.key() << " bytes: median " << elapsed.at(elapsed.size() / 2) << " ms in "
+            << elapsed.size() << " runs" << endl;
+    }
+    err << tr("%1 runs, %2 failed").arg(m_runs.size()).arg(m_failed) << endl;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Lets a number of clients download the same image from a QTftpServer on
+ * 127.0.0.1 at once, first each on its own (unicast) and then sharing a
+ * multicast group (RFC 2090), and writes one tab separated line per run.
+ * Every client's copy is checked against the image.
+ *
+ */
+
+#ifndef MULTICASTRUNNER_H
+#define MULTICASTRUNNER_H
+
+#include <QObject>
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QTextStream>
+#include "qtftpsessionmanager.h"
+#include "qtftpserver.h"
+
+class MulticastRunner : public QObject
+{
+    Q_OBJECT
+public:
+    /* The images are written to root, which the server has to serve */
+    MulticastRunner(QTftpSessionManager *manager, QTftpServer *server, const QString &root,
+                    const QNetworkInterface &iface, QTextStream *out, QObject *parent = 0);
+    virtual ~MulticastRunner();
+
+    void addCase(qint64 size, int clients, int runs);
+    void start();
+    int exitCode() const;
+    void printSummary();
+
+private slots:
+    void runNext();
+    void sessionFinished(int id, bool error, const QString &message);
+
+private:
+    struct Run {
+        bool multicast;
+        qint64 size;
+        int clients;
+        int run;
+        qint64 elapsed;
+        int failed;
+        bool ok;
+    };
+    QString imageFile(qint64 size);
+    void report(const Run &run, const QString &message);
+
+    QTftpSessionManager *m_manager;
+    QTftpServer *m_server;
+    QString m_root;
+    QNetworkInterface m_interface;
+    QTextStream *m_out;
+    QList<Run> m_runs;
+    int m_current;
+    /* Buffers of the clients of the current run by session */
+    QHash<int, QBuffer*> m_buffers;
+    QString m_lastMessage;
+    QElapsedTimer m_timer;
+    QHash<qint64, QByteArray> m_images;
+    int m_failed;
+};
+
+#endif // MULTICASTRUNNER_H
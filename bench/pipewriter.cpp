@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "pipewriter.h"
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#endif
+
+PipeWriter::PipeWriter(QObject *parent) :
+    QThread(parent),
+    m_duration(0),
+    m_readDescriptor(-1),
+    m_writeDescriptor(-1)
+{
+}
+
+PipeWriter::~PipeWriter()
+{
+    finish();
+}
+
+int PipeWriter::open(const QByteArray &data, int duration)
+{
+    finish();
+#ifdef Q_OS_UNIX
+    int descriptors[2];
+    if (pipe(descriptors) != 0)
+        return -1;
+    /* A transfer that fails closes the read end early, which must not kill us */
+    signal(SIGPIPE, SIG_IGN);
+    m_readDescriptor = descriptors[0];
+    m_writeDescriptor = descriptors[1];
+    m_data = data;
+    m_duration = duration;
+    start();
+    return m_readDescriptor;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(duration);
+    return -1;
+#endif
+}
+
+void PipeWriter::finish()
+{
+#ifdef Q_OS_UNIX
+    if (m_readDescriptor >= 0)
+        ::close(m_readDescriptor);
+#endif
+    m_readDescriptor = -1;
+    wait();
+}
+
+void PipeWriter::run()
+{
+#ifdef Q_OS_UNIX
+    const int slice = qMax(1, (m_data.size() + PIPE_WRITER_SLICES - 1) / PIPE_WRITER_SLICES);
+    int offset = 0;
+    while (offset < m_data.size()) {
+        const int end = qMin(offset + slice, m_data.size());
+        while (offset < end) {
+            const ssize_t written = ::write(m_writeDescriptor, m_data.constData() + offset, end - offset);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0) {
+                offset = m_data.size();
+                break;
+            }
+            offset += written;
+        }
+        msleep(m_duration / PIPE_WRITER_SLICES);
+    }
+    /* The end of file, which ends the stream */
+    ::close(m_writeDescriptor);
+    m_writeDescriptor = -1;
+#endif
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * PipeWriter feeds an image into a pipe from a thread of its own, slice
+ * by slice over a given time, like a slow producer such as avr-objcopy
+ * piped into the command line flasher. The read end is handed to a
+ * QTftpPipeReader.
+ *
+ */
+
+#ifndef PIPEWRITER_H
+#define PIPEWRITER_H
+
+#include <QThread>
+#include <QByteArray>
+
+/* Pieces the image is written in */
+#define PIPE_WRITER_SLICES 64
+
+class PipeWriter : public QThread
+{
+    Q_OBJECT
+public:
+    explicit PipeWriter(QObject *parent = 0);
+    ~PipeWriter();
+
+    /* Creates the pipe and starts writing data into it over duration ms, returns the read end or -1 */
+    int open(const QByteArray &data, int duration);
+    /* Closes the read end, which stops a writer that is still busy, and waits for the thread */
+    void finish();
+
+protected:
+    void run();
+
+private:
+    QByteArray m_data;
+    int m_duration;
+    int m_readDescriptor;
+    int m_writeDescriptor;
+};
+
+#endif // PIPEWRITER_H
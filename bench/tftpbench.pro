@@ -0,0 +1,29 @@
+#-------------------------------------------------
+#
+# End to end throughput of the TFTP engine against
+# an impaired loopback peer, no hardware needed
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = tftpbench
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+include(../qtftp.pri)
+
+SOURCES += main.cpp \
+    loopbackpeer.cpp \
+    benchrunner.cpp \
+    multicastrunner.cpp \
+    timerbench.cpp \
+    pipewriter.cpp
+
+HEADERS  += loopbackpeer.h \
+    benchrunner.h \
+    multicastrunner.h \
+    timerbench.h \
+    pipewriter.h
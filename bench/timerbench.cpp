@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "timerbench.h"
+#include <QString>
+#include <time.h>
+
+/* Expiries per session in the second part */
+#define TIMER_BENCH_EXPIRIES 20
+/* Timeouts of the second part, about what a LAN and TFTP_MIN_RTO give */
+#define TIMER_BENCH_MIN_TIMEOUT 20
+#define TIMER_BENCH_MAX_TIMEOUT 60
+
+TimerBenchSession::TimerBenchSession(bool wheel, TimerBench *bench) :
+    m_bench(bench),
+    m_timer(NULL),
+    m_wheelTimer(NULL),
+    m_due(0)
+{
+    if (wheel) {
+        m_wheelTimer = new QTftpWheelTimer(this);
+        connect(m_wheelTimer, SIGNAL(timeout()), this, SLOT(expired()));
+    } else {
+        /* Set up like the QTimer QTftp used to have */
+        m_timer = new QTimer(this);
+        connect(m_timer, SIGNAL(timeout()), this, SLOT(expired()));
+    }
+}
+
+void TimerBenchSession::start(int msec)
+{
+    m_due = m_bench->now() + msec;
+    if (m_wheelTimer != NULL)
+        m_wheelTimer->start(msec);
+    else
+        m_timer->start(msec);
+}
+
+void TimerBenchSession::expired()
+{
+    m_bench->expired(this);
+}
+
+TimerBench::TimerBench(QTextStream *out) :
+    m_out(out),
+    m_next(0),
+    m_expiries(0),
+    m_wanted(0),
+    m_lateness(0)
+{
+    m_clock.start();
+    m_timeouts.resize(1024);
+    for (int i = 0; i < m_timeouts.size(); i++)
+        m_timeouts[i] = TIMER_BENCH_MIN_TIMEOUT + qrand() % (TIMER_BENCH_MAX_TIMEOUT - TIMER_BENCH_MIN_TIMEOUT + 1);
+}
+
+int TimerBench::run(int restarts)
+{
+    static const int sessions[] = { 10, 100, 1000 };
+    *m_out << "timers\tsessions\trestarts\tns/restart\texpiries\tcpu ms\tms late" << endl;
+    for (unsigned i = 0; i < sizeof(sessions) / sizeof(sessions[0]); i++) {
+        measure(false, sessions[i], restarts);
+        measure(true, sessions[i], restarts);
+    }
+    return 0;
+}
+
+int TimerBench::timeout()
+{
+    m_next = (m_next + 1) % m_timeouts.size();
+    return m_timeouts.at(m_next);
+}
+
+void TimerBench::measure(bool wheel, int count, int restarts)
+{
+    QList<TimerBenchSession*> sessions;
+    for (int i = 0; i < count; i++)
+        sessions.append(new TimerBenchSession(wheel, this));
+
+    /* Restarts only, far enough out that nothing expires meanwhile */
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < restarts; i++)
+        sessions.at(i % count)->start(100 * timeout());
+    const qint64 restartTime = timer.nsecsElapsed();
+
+    m_expiries = 0;
+    m_wanted = (qint64) count * TIMER_BENCH_EXPIRIES;
+    m_lateness = 0;
+    const clock_t cpu = clock();
+    foreach (TimerBenchSession *session, sessions)
+        session->start(timeout());
+    m_loop.exec();
+    const double cpuTime = 1000.0 * (clock() - cpu) / CLOCKS_PER_SEC;
+
+    *m_out << (wheel ? "wheel" : "QTimer") << '\t' << count << '\t' << restarts << '\t'
+           << QString::number(restarts > 0 ? (double) restartTime / restarts : 0, 'f', 1) << '\t'
+           << m_expiries << '\t' << QString::number(cpuTime, 'f', 1) << '\t'
+           << QString::number(m_expiries > 0 ? (double) m_lateness / m_expiries : 0, 'f', 2) << endl;
+    qDeleteAll(sessions);
+}
+
+void TimerBench::expired(TimerBenchSession *session)
+{
+    m_lateness += now() - session->due();
+    if (++m_expiries >= m_wanted) {
+        /* Whatever else is still armed goes with its session */
+        m_loop.quit();
+        return;
+    }
+    session->start(timeout());
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Compares a QTimer per session with the QTftpTimerWheel the sessions
+ * share, at 10, 100 and 1000 sessions. First every session restarts its
+ * retransmission timer as if an ACK had arrived, which is what a transfer
+ * does once per window. Then the timers are left to expire and rearm for a
+ * while, measuring the CPU time of the event loop and how late they fire.
+ *
+ */
+
+#ifndef TIMERBENCH_H
+#define TIMERBENCH_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QList>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+#include "qtftptimerwheel.h"
+
+class TimerBench;
+
+class TimerBenchSession : public QObject
+{
+    Q_OBJECT
+public:
+    TimerBenchSession(bool wheel, TimerBench *bench);
+
+    void start(int msec);
+    qint64 due() const {
+        return m_due;
+    }
+
+private slots:
+    void expired();
+
+private:
+    TimerBench *m_bench;
+    QTimer *m_timer;
+    QTftpWheelTimer *m_wheelTimer;
+    qint64 m_due;
+};
+
+class TimerBench : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TimerBench(QTextStream *out);
+
+    int run(int restarts);
+
+    qint64 now() const {
+        return m_clock.elapsed();
+    }
+    void expired(TimerBenchSession *session);
+
+private:
+    void measure(bool wheel, int sessions, int restarts);
+    int timeout();
+
+    QTextStream *m_out;
+    QElapsedTimer m_clock;
+    QEventLoop m_loop;
+    /* Retransmission timeouts the sessions pick from, in ms */
+    QVector<int> m_timeouts;
+    int m_next;
+    qint64 m_expiries;
+    qint64 m_wanted;
+    qint64 m_lateness;
+};
+
+#endif // TIMERBENCH_H
@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Headless batch flashing, no widgets involved
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = ethersexflash-cli
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+include(../qtftp.pri)
+
+SOURCES += main.cpp \
+    flashbatch.cpp
+
+HEADERS  += flashbatch.h
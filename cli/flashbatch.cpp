@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "flashbatch.h"
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QStringList>
+
+FlashBatch::FlashBatch(QTftpSessionManager *manager, QTextStream *out, quint16 port, QObject *parent) :
+    QObject(parent),
+    m_manager(manager),
+    m_out(out),
+    m_port(port),
+    m_statisticsColumns(false),
+    m_readsStandardInput(false),
+    m_succeeded(0),
+    m_skipped(0),
+    m_failed(0)
+{
+    connect(m_manager, SIGNAL(sessionStarted(int)), this, SLOT(sessionStarted(int)));
+    connect(m_manager, SIGNAL(sessionStatistics(int,QTftpStatistics)), this, SLOT(sessionStatistics(int,QTftpStatistics)));
+    connect(m_manager, SIGNAL(sessionSkipped(int)), this, SLOT(sessionSkipped(int)));
+    connect(m_manager, SIGNAL(sessionFinished(int,bool,QString)), this, SLOT(sessionFinished(int,bool,QString)));
+    connect(m_manager, SIGNAL(done(bool)), this, SLOT(batchDone(bool)));
+}
+
+void FlashBatch::setStatisticsColumns(bool enabled)
+{
+    m_statisticsColumns = enabled;
+}
+
+bool FlashBatch::loadManifest(QIODevice *manifest, QString *errorMessage)
+{
+    int lineNumber = 0;
+    while (!manifest->atEnd()) {
+        QString line = QString::fromLocal8Bit(manifest->readLine()).simplified();
+        lineNumber++;
+        if (line.isEmpty() || line.startsWith("#"))
+            continue;
+        QStringList fields = line.split(' ');
+        if (fields.size() < 2 || fields.size() > 3) {
+            *errorMessage = tr("Line %1: expected <host> <image> [<remote file name>]").arg(lineNumber);
+            return false;
+        }
+        Job job;
+        job.host = fields.at(0);
+        job.imageFile = fields.at(1);
+        job.remoteFile = fields.size() == 3 ? fields.at(2) : QFileInfo(job.imageFile).fileName();
+        job.stream = NULL;
+        job.skipped = false;
+        if (job.imageFile == "-") {
+            if (fields.size() != 3 || m_readsStandardInput) {
+                *errorMessage = tr("Line %1: only one image can come from standard input, and it needs a remote file name").arg(lineNumber);
+                return false;
+            }
+            m_readsStandardInput = true;
+        }
+        m_jobs.append(job);
+    }
+    if (m_jobs.isEmpty()) {
+        *errorMessage = tr("The manifest is empty");
+        return false;
+    }
+    return true;
+}
+
+bool FlashBatch::start()
+{
+    *m_out << "host\tresult\tbytes\tmilliseconds\t";
+    if (m_statisticsColumns)
+        *m_out << "retransmissions\trtt\tgoodput\t";
+    *m_out << "message" << endl;
+    for (int i = 0; i < m_jobs.size(); i++) {
+        Job &job = m_jobs[i];
+        int id;
+        if (job.imageFile == "-") {
+            /* Sent block by block as it arrives, e.g. straight out of avr-objcopy */
+            job.stream = new QTftpPipeReader(0, this);
+            if (!job.stream->open(QIODevice::ReadOnly)) {
+                report(job, true, tr("Unable to open standard input: ") + job.stream->errorString());
+                continue;
+            }
+            id = m_manager->put(job.host, job.stream, job.remoteFile, m_port);
+        } else {
+            /* Hosts sharing an image share its mapping as well */
+            job.image = QTftpImage::map(job.imageFile);
+            if (job.image.isNull()) {
+                report(job, true, tr("Unable to open ") + job.imageFile);
+                continue;
+            }
+            id = m_manager->put(job.host, job.image, job.remoteFile, m_port);
+        }
+        if (id < 0) {
+            report(job, true, tr("Unable to start the transfer"));
+            continue;
+        }
+        m_jobBySession.insert(id, i);
+    }
+    return !m_jobBySession.isEmpty();
+}
+
+int FlashBatch::exitCode() const
+{
+    return m_failed > 0 ? 1 : 0;
+}
+
+void FlashBatch::sessionStarted(int id)
+{
+    if (m_jobBySession.contains(id))
+        m_jobs[m_jobBySession.value(id)].timer.start();
+}
+
+void FlashBatch::sessionStatistics(int id, const QTftpStatistics &statistics)
+{
+    if (m_jobBySession.contains(id))
+        m_jobs[m_jobBySession.value(id)].statistics = statistics;
+}
+
+void FlashBatch::sessionSkipped(int id)
+{
+    if (m_jobBySession.contains(id))
+        m_jobs[m_jobBySession.value(id)].skipped = true;
+}
+
+void FlashBatch::sessionFinished(int id, bool error, const QString &message)
+{
+    if (!m_jobBySession.contains(id))
+        return;
+    Job &job = m_jobs[m_jobBySession.take(id)];
+    report(job, error, message);
+    /* Release the mapping as soon as nobody needs it anymore */
+    job.image = QTftpImage();
+    if (job.stream != NULL)
+        job.stream->close();
+}
+
+void FlashBatch::printSummary()
+{
+    QTextStream err(stderr);
+    if (m_skipped > 0)
+        err << tr("%1 succeeded, %2 skipped as identical, %3 failed").arg(m_succeeded).arg(m_skipped).arg(m_failed) << endl;
+    else
+        err << tr("%1 succeeded, %2 failed").arg(m_succeeded).arg(m_failed) << endl;
+}
+
+void FlashBatch::batchDone(bool error)
+{
+    Q_UNUSED(error);
+    printSummary();
+    QCoreApplication::exit(exitCode());
+}
+
+void FlashBatch::report(const FlashBatch::Job &job, bool error, const QString &message)
+{
+    if (error)
+        m_failed++;
+    else if (job.skipped)
+        m_skipped++;
+    else
+        m_succeeded++;
+    QString text = message;
+    text.replace("\t", " ");
+    text.replace("\n", " ");
+    *m_out << job.host << '\t'
+           << (error ? "failed" : (job.skipped ? "skipped" : "ok")) << '\t'
+           << (error || job.skipped ? 0 : (job.stream != NULL ? job.stream->pos() : job.image.size())) << '\t'
+           << (job.timer.isValid() ? job.timer.elapsed() : 0) << '\t';
+    if (m_statisticsColumns) {
+        /* Median RTT in ms rounded up to a power of two, goodput in bytes/s */
+        *m_out << job.statistics.retransmissions << '\t'
+               << job.statistics.medianRtt() << '\t'
+               << (qint64) job.statistics.goodput << '\t';
+    }
+    *m_out << text << endl;
+}
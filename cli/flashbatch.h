@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Flashes every host of a manifest through a QTftpSessionManager and writes
+ * one tab separated result line per host. A manifest line looks like
+ *
+ *     <host> <image> [<remote file name>]
+ *
+ * Empty lines and lines starting with # are ignored. An image of - is
+ * streamed from standard input while it is being produced, which needs
+ * the remote file name and works for one line only.
+ *
+ */
+
+#ifndef FLASHBATCH_H
+#define FLASHBATCH_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QTextStream>
+#include "qtftpsessionmanager.h"
+#include "qtftppipereader.h"
+
+class FlashBatch : public QObject
+{
+    Q_OBJECT
+public:
+    FlashBatch(QTftpSessionManager *manager, QTextStream *out, quint16 port = 69, QObject *parent = 0);
+
+    /* Adds retransmission, median RTT and goodput columns before the message */
+    void setStatisticsColumns(bool enabled);
+    bool loadManifest(QIODevice *manifest, QString *errorMessage);
+    /* A line of the manifest streams its image from standard input */
+    bool readsStandardInput() const {
+        return m_readsStandardInput;
+    }
+    /* Queues all jobs, returns false if there is nothing left to wait for */
+    bool start();
+    int exitCode() const;
+    void printSummary();
+
+private slots:
+    void sessionStarted(int id);
+    void sessionStatistics(int id, const QTftpStatistics &statistics);
+    void sessionSkipped(int id);
+    void sessionFinished(int id, bool error, const QString &message);
+    void batchDone(bool error);
+
+private:
+    struct Job {
+        QString host;
+        QString imageFile;
+        QString remoteFile;
+        QTftpImage image;
+        /* Standard input, if the image is - */
+        QTftpPipeReader *stream;
+        QElapsedTimer timer;
+        QTftpStatistics statistics;
+        /* The device already had the image, see QTftpSessionManager::setVerification() */
+        bool skipped;
+    };
+    void report(const Job &job, bool error, const QString &message);
+
+    QTftpSessionManager *m_manager;
+    QTextStream *m_out;
+    quint16 m_port;
+    bool m_statisticsColumns;
+    bool m_readsStandardInput;
+    QList<Job> m_jobs;
+    QHash<int, int> m_jobBySession;
+    int m_succeeded;
+    int m_skipped;
+    int m_failed;
+};
+
+#endif // FLASHBATCH_H
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+#include <stdio.h>
+#include "flashbatch.h"
+#include "qtftpsessionmanager.h"
+#include "qtftpserver.h"
+
+static void usage(QTextStream &err)
+{
+    err << "Usage: ethersexflash-cli [options] <manifest|->" << endl
+        << "       ethersexflash-cli [options] --serve <directory>" << endl
+        << endl
+        << "Uploads an image to every host of the manifest, one line per host:" << endl
+        << "    <host> <image> [<remote file name>]" << endl
+        << "An image of - is streamed from standard input as it is produced." << endl
+        << "Prints one tab separated result line per host. Exits with 0 if all" << endl
+        << "uploads succeeded, 1 if any failed and 2 on usage errors." << endl
+        << "With --serve, answers read requests of devices that pull their" << endl
+        << "firmware at boot with the files below <directory> until killed." << endl
+        << endl
+        << "Options:" << endl
+        << "  -j, --jobs <n>         transfers running at once (default " << TFTP_DEFAULT_CONCURRENT_SESSIONS << ")" << endl
+        << "  -p, --port <port>      TFTP port of the devices or to listen on (default 69)" << endl
+        << "  --blksize <bytes>      block size to request, 512 disables the option" << endl
+        << "  --windowsize <blocks>  window size to request, 1 disables the option" << endl
+        << "  --retries <n>          retransmissions before a transfer fails" << endl
+        << "  --timeout <seconds>    retransmission timeout to agree on, 0 disables the option" << endl
+        << "  --armed <seconds>      resend each request every " << TFTP_DEFAULT_ARMED_INTERVAL << " ms for up to <seconds>" << endl
+        << "                         until the device answers, e.g. while it is power cycled" << endl
+        << "  --block-wrap <0|1>     block number following 65535 (default " << TFTP_DEFAULT_BLOCK_WRAP << "), has to match the" << endl
+        << "                         peer for images of more than 65535 blocks" << endl
+        << "  --pace <burst>:<gap>   send at most <burst> DATA packets of a window at once and" << endl
+        << "                         wait <gap> ms before the next, for devices that drop" << endl
+        << "                         packets sent back to back" << endl
+        << "  --pace auto            pace only once packets get lost and find the fastest" << endl
+        << "                         pacing that keeps them from getting lost" << endl
+        << "  --profiles             start with what worked for each host last time and" << endl
+        << "                         remember what works now, kept per host in the settings" << endl
+        << "  --verify               read each image back after the upload and compare hashes" << endl
+        << "  --skip-identical       read each image first and skip hosts that have it already" << endl
+        << "  --statistics           add retransmission, median RTT and goodput columns" << endl
+        << "  --serve <directory>    run as a read-only TFTP server" << endl
+        << "  --multicast <group>[:<port>]" << endl
+        << "                         with --serve, send to this group when clients ask for" << endl
+        << "                         multicast (default port " << TFTP_DEFAULT_MULTICAST_PORT << ")" << endl
+        << "  --interface <name>     network interface of the multicast group" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setOrganizationName("Ethersex");
+    QCoreApplication::setOrganizationDomain("www.ethersex.de");
+    QCoreApplication::setApplicationName("EthersexFlash");
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    QTftpSessionManager manager;
+    QString manifestName;
+    QString serveRoot;
+    QString multicast;
+    QString interfaceName;
+    bool jobsSet = false;
+    bool statistics = false;
+    bool verify = false;
+    bool skipIdentical = false;
+    quint16 port = 69;
+    quint16 blockWrap = TFTP_DEFAULT_BLOCK_WRAP;
+    int pacingBurst = 0;
+    int pacingGap = 0;
+    bool pacingAutoTune = false;
+
+    QStringList args = QCoreApplication::arguments();
+    for (int i = 1; i < args.size(); i++) {
+        QString arg = args.at(i);
+        bool ok = true;
+        if ((arg == "-j" || arg == "--jobs") && i+1 < args.size()) {
+            manager.setMaxConcurrentSessions(args.at(++i).toInt(&ok));
+            jobsSet = true;
+        } else if ((arg == "-p" || arg == "--port") && i+1 < args.size()) {
+            port = args.at(++i).toUShort(&ok);
+        } else if (arg == "--blksize" && i+1 < args.size()) {
+            manager.setBlockSize(args.at(++i).toUShort(&ok));
+        } else if (arg == "--windowsize" && i+1 < args.size()) {
+            manager.setWindowSize(args.at(++i).toUShort(&ok));
+        } else if (arg == "--retries" && i+1 < args.size()) {
+            manager.setMaxRetries(args.at(++i).toInt(&ok));
+        } else if (arg == "--timeout" && i+1 < args.size()) {
+            manager.setTimeoutInterval(args.at(++i).toInt(&ok));
+        } else if (arg == "--armed" && i+1 < args.size()) {
+            manager.setArmedMode(TFTP_DEFAULT_ARMED_INTERVAL, args.at(++i).toInt(&ok) * 1000);
+        } else if (arg == "--block-wrap" && i+1 < args.size()) {
+            blockWrap = args.at(++i).toUShort(&ok);
+            ok = ok && blockWrap <= 1;
+            manager.setBlockWrap(blockWrap);
+        } else if (arg == "--pace" && i+1 < args.size()) {
+            const QString pace = args.at(++i);
+            if (pace == "auto") {
+                pacingAutoTune = true;
+            } else {
+                bool gapOk = false;
+                pacingBurst = pace.section(':', 0, 0).toInt(&ok);
+                pacingGap = pace.section(':', 1).toInt(&gapOk);
+                ok = ok && gapOk && pacingBurst > 0 && pacingGap >= 0 && pacingGap <= TFTP_MAX_PACING_GAP;
+            }
+            manager.setPacing(pacingBurst, pacingGap, pacingAutoTune);
+        } else if (arg == "--profiles") {
+            manager.setDeviceProfiles(true);
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "--skip-identical") {
+            skipIdentical = true;
+        } else if (arg == "--statistics") {
+            statistics = true;
+        } else if (arg == "--serve" && i+1 < args.size()) {
+            serveRoot = args.at(++i);
+        } else if (arg == "--multicast" && i+1 < args.size()) {
+            multicast = args.at(++i);
+        } else if (arg == "--interface" && i+1 < args.size()) {
+            interfaceName = args.at(++i);
+        } else if (arg == "-h" || arg == "--help") {
+            usage(out);
+            return 0;
+        } else if (manifestName.isEmpty() && (arg == "-" || !arg.startsWith("-"))) {
+            manifestName = arg;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            err << "Invalid argument: " << arg << endl;
+            usage(err);
+            return 2;
+        }
+    }
+    if (!serveRoot.isEmpty()) {
+        if (!manifestName.isEmpty() || !QDir(serveRoot).exists()) {
+            usage(err);
+            return 2;
+        }
+        QTftpServer server;
+        server.setRootDirectory(serveRoot);
+        server.setBlockWrap(blockWrap);
+        server.setPacing(pacingBurst, pacingGap, pacingAutoTune);
+        if (jobsSet)
+            server.setMaxConcurrentSessions(manager.maxConcurrentSessions());
+        if (!multicast.isEmpty()) {
+            /* IPv6 groups contain colons themselves */
+            QHostAddress group;
+            quint16 groupPort = TFTP_DEFAULT_MULTICAST_PORT;
+            bool ok = group.setAddress(multicast);
+            const int colon = multicast.lastIndexOf(':');
+            if (!ok && colon > 0) {
+                ok = group.setAddress(multicast.left(colon));
+                if (ok)
+                    groupPort = multicast.mid(colon+1).toUShort(&ok);
+            }
+            QNetworkInterface iface;
+            if (!interfaceName.isEmpty())
+                iface = QNetworkInterface::interfaceFromName(interfaceName);
+            if (!ok || (!interfaceName.isEmpty() && !iface.isValid())) {
+                usage(err);
+                return 2;
+            }
+            server.setMulticastGroup(group, groupPort, iface);
+        }
+        if (!server.listen(QHostAddress::Any, port)) {
+            err << "Unable to listen on port " << port << endl;
+            return 2;
+        }
+        return app.exec();
+    }
+    if (manifestName.isEmpty()) {
+        usage(err);
+        return 2;
+    }
+
+    QFile manifest;
+    bool opened;
+    if (manifestName == "-") {
+        opened = manifest.open(stdin, QIODevice::ReadOnly);
+    } else {
+        manifest.setFileName(manifestName);
+        opened = manifest.open(QIODevice::ReadOnly);
+    }
+    if (!opened) {
+        err << "Unable to open " << manifestName << endl;
+        return 2;
+    }
+
+    manager.setVerification(verify, skipIdentical);
+    FlashBatch batch(&manager, &out, port);
+    batch.setStatisticsColumns(statistics);
+    QString errorMessage;
+    if (!batch.loadManifest(&manifest, &errorMessage)) {
+        err << errorMessage << endl;
+        return 2;
+    }
+    if (manifestName == "-" && batch.readsStandardInput()) {
+        err << "The manifest and an image can't both come from standard input" << endl;
+        return 2;
+    }
+    if (!batch.start()) {
+        batch.printSummary();
+        return batch.exitCode();
+    }
+    return app.exec();
+}
@@ -22,18 +22,22 @@
 #include <QMessageBox>
 #include <QSettings>
 #include <QTimer>
+#include <limits.h>
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
-    m_tftp(new QTftp),
-    m_file(NULL),
+    m_tftp(new QTftpThread(this)),
     m_connected(false)
 {
     QCoreApplication::setOrganizationName("Ethersex");
     QCoreApplication::setOrganizationDomain("www.ethersex.de");
     QCoreApplication::setApplicationName("EthersexFlash");
     ui->setupUi(this);
+    /* The upload starts as soon as the bootloader answers after a reset */
+    m_tftp->setArmedMode(TFTP_DEFAULT_ARMED_INTERVAL);
+    /* Known devices start with what worked for them last time, see saveSettings() */
+    m_tftp->setDeviceProfiles(true);
     setWindowIcon(QIcon(":/icons/bunnies.png"));
     setupSignalsAndSlots();
     QTimer::singleShot(0, this, SLOT(restoreSettings()));
@@ -43,12 +47,6 @@ MainWindow::~MainWindow()
 {
     saveSettings();
     delete ui;
-    if (m_file == NULL)
-        return;
-    if (m_file->isOpen()) {
-        m_file->close();
-        delete m_file;
-    }
 }
 
 void MainWindow::setupSignalsAndSlots()
@@ -56,7 +54,7 @@ void MainWindow::setupSignalsAndSlots()
     connect(this, SIGNAL(imageFilenameChanged(QString)), this, SLOT(processFilenameChange(QString)));
     connect(ui->imageLine, SIGNAL(textChanged(QString)), this, SLOT(processFilenameChange(QString)));
     connect(m_tftp, SIGNAL(stateChanged(QTftp::State)), this, SLOT(tftpState(QTftp::State)));
-    connect(m_tftp, SIGNAL(dataTransferProgress(qint64,qint64)), this, SLOT(updateDataTransferProgress(qint64,qint64)));
+    connect(m_tftp, SIGNAL(progress(QTftpProgress)), this, SLOT(updateProgress(QTftpProgress)));
     connect(m_tftp, SIGNAL(done(bool)), this, SLOT(tftpDone(bool)));
     connect(m_tftp, SIGNAL(error(QTftp::ErrorCode,QString)), this, SLOT(tftpHandleError(QTftp::ErrorCode,QString)));
 }
@@ -90,10 +88,20 @@ void MainWindow::on_flashButton_clicked()
         m_tftp->connectToHost(ui->targetLine->currentText(), 69);
 }
 
-void MainWindow::updateDataTransferProgress(qint64 readBytes, qint64 totalBytes)
+void MainWindow::updateProgress(const QTftpProgress &progress)
 {
-    ui->progressBar->setMaximum(totalBytes);
-    ui->progressBar->setValue(readBytes);
+    /* Already rate limited by the engine, see QTftpProgressMeter */
+    /* QProgressBar takes an int, images beyond 2 GiB are shown in KiB */
+    const int shift = progress.total > INT_MAX ? 10 : 0;
+    if (ui->progressBar->maximum() != (int) (progress.total >> shift))
+        ui->progressBar->setMaximum(progress.total >> shift);
+    ui->progressBar->setValue(progress.done >> shift);
+    QString message = tr("Transfering, %1 KiB/s").arg(progress.currentRate / 1024, 0, 'f', 1);
+    if (progress.eta >= 0)
+        message += tr(", %1 s left").arg((progress.eta + 999) / 1000);
+    if (progress.retransmissions > 0)
+        message += tr(", %1 retransmissions").arg(progress.retransmissions);
+    ui->statusBar->showMessage(message);
 }
 void MainWindow::upload()
 {
@@ -102,14 +110,13 @@ void MainWindow::upload()
         QMessageBox::warning(this, tr("Error"), tr("Please select a firmware file first."));
         return;
     }
-    m_file = new QFile(m_filename);
-    if (!m_file->open(QIODevice::ReadOnly)) {
+    if (!fi.isFile() || !fi.isReadable()) {
         QMessageBox::warning(this, tr("Error"), tr("Unable to open ") + m_filename + " ");
-        delete m_file;
         return;
     } else {
-        QMessageBox::information(this, tr("Prepare your device now."), tr("Please reset your Ethersex device to the bootloader and press OK"));
-        m_tftp->put(m_file, fi.fileName());
+        /* The transfer thread maps the file itself */
+        m_tftp->putFile(m_filename, fi.fileName());
+        ui->statusBar->showMessage(tr("Waiting for the bootloader, please reset your Ethersex device now"));
     }
 }
 void MainWindow::tftpState(QTftp::State state)
@@ -139,8 +146,6 @@ void MainWindow::tftpDone(bool error)
 {
     if (!error)
         QMessageBox::information(this, tr("Upload sucessful"), tr("You should now be able to access your ethersex device."));
-    if (m_file->isOpen() && m_file != NULL)
-        m_file->close();
 }
 
 void MainWindow::tftpHandleError(QTftp::ErrorCode, const QString &message)
@@ -177,4 +182,5 @@ void MainWindow::saveSettings()
     }
     settings.setValue("lastImage", ui->imageLine->text());
     settings.setValue("devices", devices);
+    /* The transfer thread keeps the profiles of the devices below deviceProfiles/ */
 }
@@ -2,8 +2,7 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include <qtftp.h>
-#include <QFile>
+#include <qtftpthread.h>
 
 namespace Ui
 {
@@ -28,7 +27,7 @@ private slots:
     void tftpDone(bool error);
     void tftpHandleError(QTftp::ErrorCode ,const QString &message);
     void on_flashButton_clicked();
-    void updateDataTransferProgress(qint64 readBytes, qint64 totalBytes);
+    void updateProgress(const QTftpProgress &progress);
     void on_targetLine_textChanged(const QString &arg1);
     void restoreSettings();
     void saveSettings();
@@ -37,8 +36,7 @@ signals:
     void imageFilenameChanged(QString filename);
 private:
     Ui::MainWindow *ui;
-    QTftp *m_tftp;
-    QFile *m_file;
+    QTftpThread *m_tftp;
     QString m_filename;
     bool m_connected;
 };
@@ -20,24 +20,73 @@
  * from Qt's QFTP class.
  * Source: http://qt.gitorious.org/qt/qt/blobs/4.8/src/network/access/qftp.h
  *
- * Note that this implementation currently only can handle one connection and one
- * command at a time. NetAscii and Mail are also unsupported.
+ * Note that one QTftp object only handles one connection and one command at a time,
+ * QTftpSessionManager runs many of them in parallel. NetAscii and Mail are unsupported.
  *
  */
 
 #include "qtftp.h"
-#include "qendian.h"
-#include <QDebug>
+#include "qtftplogging.h"
+#include <QBuffer>
 #include <QTimer>
+#include <string.h>
 
 QTftp::QTftp(QObject *parent) :
     QObject(parent),
     m_currentPacket(NULL),
-    m_resentTimer(new QTimer(this)),
+    m_windowHead(0),
+    m_windowCount(0),
+    m_windowSent(0),
+    m_fastRetransmitted(false),
+    m_ackedRetransmitted(false),
+    m_duplicateAckedAt(-1),
+    m_armedInterval(0),
+    m_armedTimeout(TFTP_DEFAULT_ARMED_TIMEOUT),
+    m_armedSince(-1),
+    m_multicastRequested(false),
+    m_multicastSent(false),
+    m_multicastSocket(NULL),
+    m_multicastSenderPort(0),
+    m_multicastMaster(false),
+    m_multicastFirstMissing(1),
+    m_multicastLastBlock(-1),
+    m_multicastServer(false),
+    m_multicastPort(0),
+    m_stateSince(0),
+    m_maxRetries(TFTP_DEFAULT_RETRIES),
+    m_resentTimer(new QTftpWheelTimer(this)),
+    m_paceTimer(new QTimer(this)),
+    m_probeSentAt(-1),
+    m_sourceOffset(0),
+    m_streaming(false),
+    m_streamEnded(false),
+    m_streamPacket(NULL),
+    m_sourceHashing(false),
+    m_sourceHash(TFTP_VERIFY_HASH),
     m_udpSocket(NULL),
-    m_State(Idle)
+    m_State(Idle),
+    m_blockWrap(TFTP_DEFAULT_BLOCK_WRAP),
+    m_requestedBlockSize(TFTP_ETHERNET_BLOCKSIZE),
+    m_blockSize(TFTP_DEFAULT_BLOCKSIZE),
+    m_requestedWindowSize(TFTP_PIPELINE_WINDOWSIZE),
+    m_windowSize(TFTP_DEFAULT_WINDOWSIZE),
+    m_requestedTimeout(0),
+    m_timeout(0),
+    m_optionsSent(false),
+    m_transferSize(-1),
+    m_transferred(0),
+    m_mappedDownloads(true),
+    m_sinkFile(NULL),
+    m_sinkMap(NULL)
 {
+    m_clock.start();
     connect(m_resentTimer, SIGNAL(timeout()), this, SLOT(retransmitPacket()));
+    m_paceTimer->setSingleShot(true);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    /* A coarse timer would stretch gaps of a few ms by up to 5% or merge them */
+    m_paceTimer->setTimerType(Qt::PreciseTimer);
+#endif
+    connect(m_paceTimer, SIGNAL(timeout()), this, SLOT(sendPaced()));
     connect(this, SIGNAL(done(bool)), this, SLOT(stop(bool)));
     connect(this, SIGNAL(error(QTftp::ErrorCode,QString)), this, SLOT(setError(QTftp::ErrorCode,QString)));
 }
@@ -50,6 +99,8 @@ QTftp::~QTftp()
 int QTftp::connectToHost(const QString &host, qint16 port)
 {
     this->initSocket();
+    /* A new peer, so nothing we learned about the old path applies */
+    m_rtt.reset();
     QHostInfo::lookupHost(host, this, SLOT(lookedUp(QHostInfo)));
     m_port = port;
     this->changeState(HostLookup);
@@ -76,9 +127,13 @@ void QTftp::disconnectFromHost()
 int QTftp::close()
 {
     changeState(Closing);
-    deleteCurrentPacket();
+    releaseCurrentPacket();
+    clearWindow();
+    leaveMulticastGroup();
+    m_udpIO.setSocket(NULL);
     if (m_udpSocket != NULL)
         delete m_udpSocket;
+    m_udpSocket = NULL;
     m_resentTimer->stop();
     changeState(Idle);
     return 0;
@@ -97,41 +152,13 @@ int QTftp::get(const QString &file, QIODevice *dev, QTftp::TransferType type)
         return -1;
     m_CurrentCommand = Read;
     m_currentIODevice = dev;
+    m_streaming = false;
     m_BlockCount = 1;
-    deleteCurrentPacket();
-    char *rawPacket;
-    QByteArray typeString;
-    switch (type) {
-    case (NetAscii):
-        typeString = NETASCII;
-        qDebug() << "NetAscii is not supported";
-        emit error(UnknownError,"Transfer mode not supported");
-        return -1;
-        break;
-    case (Octet):
-        typeString = OCTET;
-        break;
-    case (Mail):
-        typeString = MAIL;
-        qDebug() << "Mail is not supported";
-        emit error(UnknownError,"Transfer mode not supported");
-        return -1;
-        break;
-    default:
-        break;
-    }
-    //type + fileString + 1 (\0) + typeString + 1 (\0)
-    int size = 2+file.toAscii().size()+typeString.size()+2;
-    rawPacket = new char[size];
-    Tftp_packet_t *Tftp_packet = (Tftp_packet_t*) rawPacket;
-    char *request = &(Tftp_packet->u.raw[0]);
-    memcpy(request, file.toAscii().data(), file.toAscii().size());
-    request[file.toAscii().size()] = '\0';
-    memcpy(request+file.toAscii().size()+1, typeString.data(), typeString.size());
-    request[file.toAscii().size()+typeString.size()+1] = '\0';
-    Tftp_packet->type = _htons(ReadRequest);
-    this->writeDatagram(rawPacket, size , m_host, m_port);
-    return 0;
+    m_blocksSinceAck = 0;
+    m_gapAcked = false;
+    m_duplicateAckedAt = -1;
+    resetStatistics();
+    return sendRequest(ReadRequest, file, type, wantsOptions());
 }
 
 int QTftp::put(QIODevice *dev, const QString &file, QTftp::TransferType type)
@@ -145,16 +172,211 @@ int QTftp::put(QIODevice *dev, const QString &file, QTftp::TransferType type)
     if (dev->isReadable() == false || dev->isOpen() == false)
         return -1;
     m_BlockCount = 0;
+    clearWindow();
+    m_sourceFinished = false;
 
     m_CurrentCommand = Write;
     m_currentIODevice = dev;
-    deleteCurrentPacket();
-    char *rawPacket;
-    QByteArray typeString;
+    m_sourceImage = QTftpImage();
+    /* Pipes and processes are read as the image is produced, see readSourceBlock() */
+    m_streaming = dev->isSequential();
+    m_streamEnded = false;
+    if (m_streaming) {
+        connect(dev, SIGNAL(readyRead()), this, SLOT(sourceReadyRead()), Qt::UniqueConnection);
+        connect(dev, SIGNAL(readChannelFinished()), this, SLOT(sourceReadChannelFinished()), Qt::UniqueConnection);
+    }
+    resetStatistics();
+    arm();
+    return sendRequest(WriteRequest, file, type, wantsOptions());
+}
+
+int QTftp::put(const QTftpImage &image, const QString &file, QTftp::TransferType type)
+{
+    if (m_State < Connected) {
+        emit error(NotConnected,tr("Not connected"));
+        return -1;
+    }
+    if (image.isNull())
+        return -1;
+    m_BlockCount = 0;
+    clearWindow();
+    m_sourceFinished = false;
+
+    m_CurrentCommand = Write;
+    m_currentIODevice = NULL;
+    m_sourceImage = image;
+    m_streaming = false;
+    resetStatistics();
+    arm();
+    return sendRequest(WriteRequest, file, type, wantsOptions());
+}
+
+int QTftp::serve(const QHostAddress &client, quint16 port, const QTftpImage &image,
+                 quint16 blockSize, quint16 windowSize, int timeout, const QByteArray &optionAck)
+{
+    if (image.isNull())
+        return -1;
+    this->initSocket();
+    if (m_State != Unconnected)
+        return -1;
+    /* The client already is the peer, there is no request to send */
+    m_host = client;
+    m_port = port;
+    m_rtt.reset();
+    changeState(Connected);
+
+    m_CurrentCommand = Write;
+    m_currentIODevice = NULL;
+    m_sourceImage = image;
+    m_streaming = false;
+    m_BlockCount = 0;
+    clearWindow();
+    m_sourceFinished = false;
+    m_optionsSent = false;
+    m_blockSize = blockSize;
+    m_windowSize = windowSize;
+    m_timeout = timeout;
+    m_rtt.setAgreedTimeout(timeout * 1000);
+    m_transferSize = image.size();
+    resetStatistics();
+    if (optionAck.isEmpty()) {
+        startUpload(client, port);
+        return 0;
+    }
+    /* The client confirms the OACK with ACK 0, which starts the upload */
+    releaseCurrentPacket();
+    QTftpPacketBuffer *rawPacket = m_pool.acquire(2+optionAck.size());
+    rawPacket->size = QTftpPacket::writeOptionAcknowledgment(rawPacket->data, rawPacket->capacity,
+                                                             optionAck.constData(), optionAck.size());
+    this->writeDatagram(rawPacket, client, port);
+    return 0;
+}
+
+int QTftp::serveMulticast(const QHostAddress &group, quint16 groupPort, const QNetworkInterface &iface,
+                          const QTftpImage &image, quint16 blockSize, int timeout)
+{
+    if (image.isNull() || image.size() / blockSize + 1 > TFTP_MULTICAST_MAX_BLOCKS)
+        return -1;
+    this->initSocket();
+    if (m_State != Unconnected)
+        return -1;
+    /* Stay on the local network, but let clients on this host listen as well */
+    m_udpSocket->setSocketOption(QAbstractSocket::MulticastTtlOption, 1);
+    m_udpSocket->setSocketOption(QAbstractSocket::MulticastLoopbackOption, 1);
+    if (iface.isValid())
+        m_udpSocket->setMulticastInterface(iface);
+    m_multicastServer = true;
+    m_multicastGroup = group;
+    m_multicastPort = groupPort;
+    m_multicastClients.clear();
+    m_host = group;
+    m_port = groupPort;
+    m_rtt.reset();
+    changeState(Connected);
+
+    m_CurrentCommand = Write;
+    m_currentIODevice = NULL;
+    m_sourceImage = image;
+    m_streaming = false;
+    m_BlockCount = 0;
+    clearWindow();
+    m_optionsSent = false;
+    m_blockSize = blockSize;
+    m_windowSize = TFTP_DEFAULT_WINDOWSIZE;
+    m_timeout = timeout;
+    m_rtt.setAgreedTimeout(timeout * 1000);
+    m_transferSize = image.size();
+    resetStatistics();
+    /* Nothing is sent before the first client is added */
+    return 0;
+}
+
+void QTftp::addMulticastClient(const QHostAddress &client, quint16 port, quint16 windowSize, const QByteArray &options)
+{
+    if (!m_multicastServer)
+        return;
+    for (int i = 0; i < m_multicastClients.size(); i++) {
+        const MulticastClient &known = m_multicastClients.at(i);
+        if (known.address == client && known.port == port) {
+            /* It repeated its RRQ, the master's OACK is retransmitted anyway */
+            if (i > 0)
+                sendMulticastOptionAck(known, false);
+            return;
+        }
+    }
+    MulticastClient joined;
+    joined.address = client;
+    joined.port = port;
+    joined.windowSize = qMax<quint16>(windowSize, TFTP_DEFAULT_WINDOWSIZE);
+    joined.options = options;
+    m_multicastClients.append(joined);
+    if (m_multicastClients.size() == 1)
+        promoteMulticastClient();
+    else
+        sendMulticastOptionAck(joined, false);
+}
+
+void QTftp::sendMulticastOptionAck(const QTftp::MulticastClient &client, bool master)
+{
+    QByteArray optionAck = client.options;
+    if (client.windowSize != TFTP_DEFAULT_WINDOWSIZE) {
+        optionAck.append("windowsize").append('\0');
+        optionAck.append(QByteArray::number(master ? m_windowSize : client.windowSize)).append('\0');
+    }
+    optionAck.append("multicast").append('\0');
+    optionAck.append(m_multicastGroup.toString().toLatin1()).append(',');
+    optionAck.append(QByteArray::number(m_multicastPort)).append(',');
+    optionAck.append(master ? '1' : '0').append('\0');
+
+    QTftpPacketBuffer *rawPacket = m_pool.acquire(2+optionAck.size());
+    rawPacket->size = QTftpPacket::writeOptionAcknowledgment(rawPacket->data, rawPacket->capacity,
+                                                             optionAck.constData(), optionAck.size());
+    if (master) {
+        /* Resent until the master ACKs it */
+        releaseCurrentPacket();
+        this->writeDatagram(rawPacket, client.address, client.port);
+    } else {
+        /* A client that misses it repeats its RRQ */
+        sendDatagram(rawPacket->data, rawPacket->size, client.address, client.port);
+        m_pool.release(rawPacket);
+    }
+}
+
+void QTftp::promoteMulticastClient()
+{
+    m_resentTimer->stop();
+    releaseCurrentPacket();
+    clearWindow();
+    changeState(Connected);
+    if (m_multicastClients.isEmpty()) {
+        /* Every client was served or given up, see multicastClientFinished() */
+        emit done(false);
+        return;
+    }
+    /* Every client left will be master some time, so go as fast as the slowest of them */
+    quint16 windowSize = m_multicastClients.first().windowSize;
+    foreach (const MulticastClient &client, m_multicastClients)
+        windowSize = qMin(windowSize, client.windowSize);
+    m_windowSize = windowSize;
+    m_BlockCount = 0;
+    sendMulticastOptionAck(m_multicastClients.first(), true);
+}
+
+void QTftp::finishMulticastClient(bool error)
+{
+    const MulticastClient master = m_multicastClients.takeFirst();
+    emit multicastClientFinished(master.address, master.port, error);
+    promoteMulticastClient();
+}
+
+int QTftp::sendRequest(QTftp::OpCode opCode, const QString &file, QTftp::TransferType type, bool withOptions)
+{
+    releaseCurrentPacket();
+    const char *typeString = OCTET;
     switch (type) {
     case (NetAscii):
         typeString = NETASCII;
-        qDebug() << "NetAscii is not supported";
+        tftpDebug() << "NetAscii is not supported";
         emit error(UnknownError,"Transfer mode not supported");
         return -1;
         break;
@@ -163,42 +385,164 @@ int QTftp::put(QIODevice *dev, const QString &file, QTftp::TransferType type)
         break;
     case (Mail):
         typeString = MAIL;
-        qDebug() << "Mail is not supported";
+        tftpDebug() << "Mail is not supported";
         emit error(UnknownError,"Transfer mode not supported");
         return -1;
         break;
     default:
         break;
     }
-    int size = 2+file.toAscii().size()+typeString.size()+2;
-    rawPacket = new char[size];
-    Tftp_packet_t *Tftp_packet = (Tftp_packet_t*) rawPacket;
-    char *request = &(Tftp_packet->u.raw[0]);
-    memcpy(request, file.toAscii().data(), file.toAscii().size());
-    request[file.toAscii().size()] = '\0';
-    memcpy(request+file.toAscii().size()+1, typeString.data(), typeString.size());
-    request[file.toAscii().size()+typeString.size()+1] = '\0';
-
-    Tftp_packet->type = _htons(WriteRequest);
-    this->writeDatagram(rawPacket, size , m_host, m_port);
+    m_requestFile = file;
+    m_requestType = type;
+    m_optionsSent = withOptions;
+    /* Until the peer acknowledges our options everything is plain RFC 1350 */
+    m_blockSize = TFTP_DEFAULT_BLOCKSIZE;
+    m_windowSize = TFTP_DEFAULT_WINDOWSIZE;
+    m_timeout = 0;
+    m_rtt.setAgreedTimeout(0);
+    m_transferred = 0;
+    /* Our own size is known on uploads, a download asks the peer with tsize 0 */
+    m_transferSize = -1;
+    if (opCode == WriteRequest && !m_sourceImage.isNull())
+        m_transferSize = m_sourceImage.size();
+    else if (opCode == WriteRequest && !m_currentIODevice->isSequential())
+        m_transferSize = m_currentIODevice->size();
+
+    /* type + file + \0 + mode + \0 [+ option + \0 + value + \0 ...], built in place */
+    QTftpPacketBuffer *rawPacket = m_pool.acquire(TFTP_MAX_REQUEST_SIZE);
+    char *request = rawPacket->data;
+    int size = QTftpPacket::writeRequest(request, TFTP_MAX_REQUEST_SIZE, opCode, file, typeString);
+    if (withOptions && m_requestedBlockSize != TFTP_DEFAULT_BLOCKSIZE)
+        size = QTftpPacket::appendOption(request, TFTP_MAX_REQUEST_SIZE, size, "blksize", m_requestedBlockSize);
+    if (withOptions && m_requestedWindowSize != TFTP_DEFAULT_WINDOWSIZE)
+        size = QTftpPacket::appendOption(request, TFTP_MAX_REQUEST_SIZE, size, "windowsize", m_requestedWindowSize);
+    if (withOptions && (opCode == ReadRequest || m_transferSize >= 0))
+        size = QTftpPacket::appendOption(request, TFTP_MAX_REQUEST_SIZE, size, "tsize",
+                                         opCode == ReadRequest ? 0 : m_transferSize);
+    if (withOptions && m_requestedTimeout > 0)
+        size = QTftpPacket::appendOption(request, TFTP_MAX_REQUEST_SIZE, size, "timeout", m_requestedTimeout);
+    /* Blocks arrive in any order, so they have to be written at random positions */
+    m_multicastSent = withOptions && opCode == ReadRequest && m_multicastRequested
+            && !m_currentIODevice->isSequential();
+    if (m_multicastSent) {
+        /* RFC 2090, the value is left empty */
+        size = QTftpPacket::appendOption(request, TFTP_MAX_REQUEST_SIZE, size, "multicast", "", 0);
+    }
+    if (size < 0) {
+        m_pool.release(rawPacket);
+        tftpDebug() << "Request for" << file << "does not fit into a packet";
+        emit error(UnknownError, tr("File name too long or not Latin-1: ") + file);
+        return -1;
+    }
+    rawPacket->size = size;
+    this->writeDatagram(rawPacket, m_host, m_port);
+    if (isArmed()) {
+        /* Nobody listens yet, so the time until the answer is no RTT sample */
+        m_probeSentAt = -1;
+        m_resentTimer->start(m_armedInterval);
+    }
     return 0;
 }
 
+void QTftp::setBlockSize(quint16 size)
+{
+    if (size < TFTP_MIN_BLOCKSIZE)
+        size = TFTP_MIN_BLOCKSIZE;
+    if (size > TFTP_MAX_BLOCKSIZE)
+        size = TFTP_MAX_BLOCKSIZE;
+    m_requestedBlockSize = size;
+}
+
+void QTftp::setWindowSize(quint16 size)
+{
+    if (size < TFTP_DEFAULT_WINDOWSIZE)
+        size = TFTP_DEFAULT_WINDOWSIZE;
+    m_requestedWindowSize = size;
+}
+
+void QTftp::resetStatistics()
+{
+    m_statistics.reset();
+    m_stateSince = m_clock.elapsed();
+}
+
+QTftpStatistics QTftp::statistics() const
+{
+    QTftpStatistics statistics = m_statistics;
+    statistics.timeInState[m_State] += m_clock.elapsed() - m_stateSince;
+    const qint64 transferTime = statistics.timeInState[Transfering];
+    statistics.goodput = transferTime > 0 ? statistics.payloadBytes * 1000.0 / transferTime : 0;
+    return statistics;
+}
+
+void QTftp::setTimeoutInterval(int seconds)
+{
+    m_requestedTimeout = qBound(0, seconds, TFTP_MAX_TIMEOUT);
+}
+
+void QTftp::setRetransmitTimeout(int minimum, int maximum)
+{
+    m_rtt.setBounds(minimum, maximum);
+}
+
+void QTftp::setInitialRetransmitTimeout(int timeout)
+{
+    m_rtt.setInitialRto(timeout);
+}
+
+void QTftp::setArmedMode(int interval, int timeout)
+{
+    m_armedInterval = qMax(0, interval);
+    m_armedTimeout = qMax(0, timeout);
+}
+
+void QTftp::setBlockWrap(quint16 block)
+{
+    if (block <= 1)
+        m_blockWrap = block;
+}
+
+void QTftp::setMulticast(bool enabled, const QNetworkInterface &iface)
+{
+    m_multicastRequested = enabled;
+    m_multicastInterface = iface;
+}
+
+void QTftp::setMaxRetries(int retries)
+{
+    m_maxRetries = qMax(0, retries);
+}
+
+void QTftp::setPacing(int burst, int gap, bool autoTune)
+{
+    m_pacer.setPacing(burst, gap, autoTune);
+}
+
+bool QTftp::wantsOptions() const
+{
+    return m_requestedBlockSize != TFTP_DEFAULT_BLOCKSIZE || m_requestedWindowSize != TFTP_DEFAULT_WINDOWSIZE
+            || m_requestedTimeout > 0 || m_multicastRequested;
+}
+
 int QTftp::put(const QByteArray &data, const QString &file, QTftp::TransferType type)
 {
-    /* TODO */
-    Q_UNUSED(data);
-    Q_UNUSED(file);
-    Q_UNUSED(type);
-    qDebug() << "Sorry but this function hasn't been implemented yet.\n";
-    return 0;
+    /* Shares data, the blocks are sliced out of it like out of a mapped file */
+    return put(QTftpImage(data), file, type);
 }
 void QTftp::stop(bool error)
 {
     if (!error)
         m_LastError = NoError;
+    m_armedSince = -1;
     m_resentTimer->stop();
-    deleteCurrentPacket();
+    releaseCurrentPacket();
+    clearWindow();
+    finishSink(error);
+    leaveMulticastGroup();
+    m_multicastServer = false;
+    m_multicastClients.clear();
+    /* Don't keep the mapping alive longer than necessary */
+    m_sourceImage = QTftpImage();
     changeState(Connected);
 }
 
@@ -216,118 +560,924 @@ void QTftp::abort()
 
 void QTftp::readPendingDatagrams()
 {
-    while (m_udpSocket->hasPendingDatagrams()) {
-        QByteArray datagram;
-        datagram.resize(m_udpSocket->pendingDatagramSize());
-        QHostAddress sender;
-        quint16 senderPort;
-        m_udpSocket->readDatagram(datagram.data(), datagram.size(),
-                                  &sender, &senderPort);
-        processTftpPacket(datagram, sender, senderPort );
+    readDatagrams(&m_udpIO);
+    /* Group DATA goes the same way, handleData() tells it apart by the socket's existence */
+    readDatagrams(&m_multicastIO);
+}
+
+void QTftp::readDatagrams(QTftpBatchIO *io)
+{
+    /* A packet may end the transfer and with it the socket, all handlers work on a view into the batch */
+    const char *data;
+    int size;
+    while (io->socket() != NULL && (size = io->readDatagram(&data, &m_rxSender, &m_rxSenderPort)) >= 0) {
+        m_statistics.packetsReceived++;
+        m_statistics.bytesReceived += size;
+        processTftpPacket(data, size, m_rxSender, m_rxSenderPort);
     }
 }
 
 
 
-void QTftp::writeDatagram(char *payload, quint16 size, QHostAddress sender, quint16 senderPort)
+void QTftp::writeDatagram(QTftpPacketBuffer *packet, const QHostAddress &host, quint16 port)
 {
-    m_resentCount = 0;
-    m_currentPacket = payload;
-    m_currentSize = size;
-    m_currentTarget = sender;
-    m_currentPort = senderPort;
-    m_udpSocket->writeDatagram(payload, size , sender, senderPort);
-    m_resentTimer->start(2500);
+    m_currentPacket = packet;
+    m_currentTarget = host;
+    m_currentPort = port;
+    sendDatagram(packet->data, packet->size, host, port);
+    m_probeSentAt = m_clock.elapsed();
+    armRetransmitTimer();
 }
 
-void QTftp::handleError(QByteArray packet, QHostAddress sender, quint16 senderPort)
+void QTftp::sendDatagram(const char *data, int size, const QHostAddress &host, quint16 port)
+{
+    m_statistics.packetsSent++;
+    m_statistics.bytesSent += size;
+    m_udpSocket->writeDatagram(data, size, host, port);
+}
+
+void QTftp::handleError(const char *packet, int size, const QHostAddress &sender, quint16 senderPort)
 {
     Q_UNUSED(sender);
     Q_UNUSED(senderPort);
-    Tftp_packet_t *tftp_packet = (Tftp_packet_t*) packet.data();
-    QString msg = tr("Protocol Error. Code ") + QString::number(_ntohs(tftp_packet->u.error.code));
-    msg += tr("\nMessage: ") + QString(tftp_packet->u.error.message);
+    quint16 code;
+    QTftpPacketString message;
+    if (!QTftpPacket::parseError(packet, size, &code, &message))
+        return;
+    /* Even an error means the device is listening now */
+    m_armedSince = -1;
+    if (code == OptionNegotiationFailed && m_optionsSent && m_State == Connected) {
+        /* The peer refused our options, repeat the request without them (RFC 2347) */
+        sendRequest(m_CurrentCommand == Read ? ReadRequest : WriteRequest, m_requestFile, m_requestType, false);
+        return;
+    }
+    QString msg = tr("Protocol Error. Code ") + QString::number(code);
+    msg += tr("\nMessage: ") + message.toString();
     emit error(ProtocolError, msg);
+    /* An error packet terminates the transfer (RFC 1350), no need to wait for the timeout */
+    if (m_State >= Connected)
+        emit done(true);
 }
-void QTftp::handleData(QByteArray packet, QHostAddress sender, quint16 senderPort)
+void QTftp::handleData(const char *packet, int size, const QHostAddress &sender, quint16 senderPort)
 {
-    Tftp_packet_t *tftp_packet = (Tftp_packet_t*) packet.data();
-    if (_ntohs(tftp_packet->u.data.block) == m_BlockCount) {
-        int size = packet.size()-sizeof(tftp_packet->type)-sizeof(tftp_packet->u.data.block);
-        if (m_BlockCount == 1) {
-            changeState(Transfering);
-            m_currentIODevice->seek(0);
+    quint16 block;
+    const char *payload;
+    if (!QTftpPacket::parseData(packet, size, &block, &payload, &size))
+        return;
+    if (m_multicastSocket != NULL) {
+        /*
+         * Other servers may stream to the same group. Only the port is
+         * checked, the group DATA may leave the server by another interface
+         * than our unicast packets.
+         */
+        if (senderPort == m_multicastSenderPort)
+            handleMulticastData(payload, size, block);
+        return;
+    }
+    const qint64 ahead = blockFromWire(block, m_BlockCount) - m_BlockCount;
+    if (ahead != 0) {
+        /*
+         * A block inside the window got lost. Tell the peer once where to continue (RFC 7440),
+         * everything else it sends until then is dropped.
+         */
+        if (m_State == Transfering && ahead > 0 && ahead < m_windowSize && !m_gapAcked) {
+            m_gapAcked = true;
+            m_blocksSinceAck = 0;
+            sendAcknowledgment(wireBlock(m_BlockCount-1), sender, senderPort);
+        } else if (ahead < 0) {
+            m_statistics.duplicates++;
+            if (ahead == -1)
+                acknowledgeDuplicate(block, sender, senderPort);
         }
-        if (m_State != Transfering)
+        return;
+    }
+    if (m_BlockCount == 1 && m_State == Connected) {
+        /* No OACK, so the first block answers our RRQ */
+        changeState(Transfering);
+        if (!m_currentIODevice->isSequential())
+            m_currentIODevice->seek(0);
+        m_meter.start();
+        prepareSink();
+    }
+    if (m_State != Transfering)
+        return;
+    sampleProbe();
+    writeSink(payload, size);
+    m_transferred += size;
+    m_statistics.payloadBytes += size;
+    reportProgress(m_transferred, qMax(m_transferSize, (qint64) 0), size < m_blockSize);
+    m_gapAcked = false;
+    m_blocksSinceAck++;
+    /* Only the last block of a window and the final block are acknowledged */
+    if (size < m_blockSize || m_blocksSinceAck >= m_windowSize) {
+        m_blocksSinceAck = 0;
+        sendAcknowledgment(wireBlock(m_BlockCount), sender, senderPort);
+    } else {
+        m_currentTarget = sender;
+        m_currentPort = senderPort;
+        armRetransmitTimer();
+    }
+    m_BlockCount++;
+    if (size < m_blockSize) {
+        changeState(Connected);
+        emit done(false);
+    }
+}
+void QTftp::acknowledgeDuplicate(quint16 block, const QHostAddress &sender, quint16 senderPort)
+{
+    /*
+     * The peer resends the last block we have, so our ACK got lost. Answer
+     * right away instead of waiting for our own timeout, but at most once per
+     * RTO, whichever block it is: acknowledging every duplicate would let
+     * both sides multiply each other's duplicates (Sorcerer's Apprentice,
+     * RFC 1123 4.2.3.1). One spurious timeout of the peer produces a
+     * duplicate of every block from then on, so the limit spans blocks.
+     */
+    if (m_CurrentCommand != Read || m_transferred == 0 || sender != m_currentTarget || senderPort != m_currentPort)
+        return;
+    if (m_duplicateAckedAt >= 0 && m_clock.elapsed() - m_duplicateAckedAt < m_rtt.rto())
+        return;
+    m_duplicateAckedAt = m_clock.elapsed();
+    m_statistics.retransmissions++;
+    if (m_State == Transfering) {
+        m_blocksSinceAck = 0;
+        sendAcknowledgment(block, sender, senderPort);
+    } else if (m_State == Connected && m_udpSocket != NULL) {
+        /* The download is complete, only the peer still waits for its final ACK */
+        char ack[TFTP_HEADER_SIZE];
+        sendDatagram(ack, QTftpPacket::writeAcknowledgment(ack, block), sender, senderPort);
+    }
+}
+void QTftp::reportProgress(qint64 done, qint64 total, bool force)
+{
+    if (!m_meter.update(done, total, m_statistics.retransmissions, force))
+        return;
+    emit dataTransferProgress(done, total);
+    emit progress(m_meter.progress());
+}
+void QTftp::reportUploadProgress(bool force)
+{
+    if (m_streaming)
+        reportProgress(m_sourceOffset, 0, force);
+    else if (m_sourceImage.isNull())
+        reportProgress(m_currentIODevice->pos(), m_currentIODevice->size(), force);
+    else
+        reportProgress(m_sourceOffset, m_sourceImage.size(), force);
+}
+void QTftp::prepareSink()
+{
+    m_transferred = 0;
+    if (m_transferSize <= 0)
+        return;
+    /* Allocate the whole file once instead of growing it block by block */
+    QFile *file = qobject_cast<QFile*>(m_currentIODevice);
+    if (file != NULL) {
+        if (!file->resize(m_transferSize))
+            return;
+        m_sinkFile = file;
+        if (m_mappedDownloads)
+            m_sinkMap = file->map(0, m_transferSize);
+        return;
+    }
+    QBuffer *buffer = qobject_cast<QBuffer*>(m_currentIODevice);
+    if (buffer != NULL)
+        buffer->buffer().reserve(m_transferSize);
+}
+void QTftp::writeSink(const char *data, int size)
+{
+    if (m_sinkMap != NULL) {
+        if (m_transferred + size <= m_transferSize) {
+            memcpy(m_sinkMap + m_transferred, data, size);
             return;
-        m_currentIODevice->write((char *)tftp_packet->u.data.data, size);
-        sendAcknowledgment(sender, senderPort);
+        }
+        /* The peer sends more than it announced, continue without the mapping */
+        m_sinkFile->unmap(m_sinkMap);
+        m_sinkMap = NULL;
+        m_sinkFile->seek(m_transferred);
+    }
+    m_currentIODevice->write(data, size);
+}
+void QTftp::writeSinkAt(qint64 offset, const char *data, int size)
+{
+    if (m_sinkMap != NULL && offset + size <= m_transferSize) {
+        memcpy(m_sinkMap + offset, data, size);
+        return;
+    }
+    m_currentIODevice->seek(offset);
+    m_currentIODevice->write(data, size);
+}
+void QTftp::finishSink(bool error)
+{
+    if (m_sinkFile == NULL)
+        return;
+    if (m_sinkMap != NULL)
+        m_sinkFile->unmap(m_sinkMap);
+    m_sinkMap = NULL;
+    /*
+     * Don't leave the preallocated tail behind, a failed download would
+     * look like a complete image. A multicast client keeps only the blocks
+     * up to the first one it is missing.
+     */
+    qint64 length = m_transferred;
+    if (error && m_multicastSocket != NULL)
+        length = qMin(length, (qint64) (m_multicastFirstMissing-1) * m_blockSize);
+    if (length != m_sinkFile->size())
+        m_sinkFile->resize(length);
+    m_sinkFile->seek(length);
+    m_sinkFile = NULL;
+}
+void QTftp::releaseCurrentPacket()
+{
+    m_pool.release(m_currentPacket);
+    m_currentPacket = NULL;
+}
+QTftp::WindowEntry &QTftp::windowEntry(int index)
+{
+    return m_window[(m_windowHead + index) % m_window.size()];
+}
+const QTftp::WindowEntry &QTftp::windowEntry(int index) const
+{
+    return m_window.at((m_windowHead + index) % m_window.size());
+}
+void QTftp::clearWindow()
+{
+    while (m_windowCount > 0) {
+        m_pool.release(windowEntry(0).packet);
+        windowEntry(0).packet = NULL;
+        m_windowHead = (m_windowHead + 1) % m_window.size();
+        m_windowCount--;
+    }
+    m_windowHead = 0;
+    m_windowSent = 0;
+    m_paceTimer->stop();
+    /* A partial block of a stream isn't part of the window yet */
+    m_pool.release(m_streamPacket);
+    m_streamPacket = NULL;
+}
+void QTftp::startUpload(const QHostAddress &host, quint16 port, qint64 firstBlock)
+{
+    if (m_State != Transfering)
+        m_meter.start();
+    changeState(Transfering);
+    releaseCurrentPacket();
+    clearWindow();
+    /* From here on every DATA packet comes from the pool */
+    m_window.resize(m_windowSize);
+    m_pool.reserve(m_blockSize, m_windowSize);
+    m_currentTarget = host;
+    m_currentPort = port;
+    m_BlockCount = firstBlock;
+    m_windowFirstBlock = firstBlock;
+    m_fastRetransmitted = false;
+    m_ackedRetransmitted = false;
+    m_sourceFinished = false;
+    /* Only a multicast master starts anywhere but at the first block */
+    m_sourceOffset = (firstBlock-1) * m_blockSize;
+    if (firstBlock == 1) {
+        m_sourceHash.reset();
+        m_pacer.reset();
+    }
+    if (m_sourceImage.isNull() && !m_streaming)
+        m_currentIODevice->seek(m_sourceOffset);
+    fillWindow();
+}
+void QTftp::fillWindow()
+{
+    bool added = false;
+    while (!m_sourceFinished && m_windowCount < m_windowSize) {
+        /* A stream that has no complete block yet is continued by sourceReadyRead() */
+        QTftpPacketBuffer *packet = NULL;
+        if (m_sourceImage.isNull() && (packet = readSourceBlock()) == NULL)
+            break;
+        WindowEntry &entry = windowEntry(m_windowCount++);
+        qint64 readBytes;
+        if (!m_sourceImage.isNull()) {
+            /* The block stays where it is, only the header is built when sending */
+            readBytes = qMin((qint64) m_blockSize, m_sourceImage.size() - m_sourceOffset);
+            entry.packet = NULL;
+            QTftpPacket::writeDataHeader(entry.header, wireBlock(m_BlockCount));
+            entry.payload = m_sourceImage.data() + m_sourceOffset;
+            entry.payloadSize = readBytes;
+        } else {
+            readBytes = packet->size - TFTP_HEADER_SIZE;
+            entry.packet = packet;
+            entry.payload = NULL;
+            entry.payloadSize = readBytes;
+        }
+        if (m_sourceHashing)
+            m_sourceHash.addData(entry.packet != NULL ? packet->data+TFTP_HEADER_SIZE : entry.payload, readBytes);
+        m_sourceOffset += readBytes;
+        if (readBytes < m_blockSize)
+            m_sourceFinished = true;
+        entry.block = m_BlockCount;
+        entry.retransmitted = false;
         m_BlockCount++;
-        if (size < 512) {
-            changeState(Connected);
-            emit done(false);
+        added = true;
+    }
+    sendPending();
+    if (added)
+        reportUploadProgress();
+    if (m_windowCount > 0)
+        armRetransmitTimer();
+    else
+        m_resentTimer->stop();
+}
+QTftpPacketBuffer *QTftp::readSourceBlock()
+{
+    //type (2B), block (2B) and payload (m_blockSize)
+    QTftpPacketBuffer *packet = m_streamPacket;
+    m_streamPacket = NULL;
+    if (packet == NULL) {
+        packet = m_pool.acquire(TFTP_HEADER_SIZE+m_blockSize);
+        packet->size = TFTP_HEADER_SIZE;
+    }
+    /* A pipe hands out what it has, so a block may take several reads */
+    while (packet->size < TFTP_HEADER_SIZE+m_blockSize) {
+        qint64 readBytes = m_currentIODevice->read(packet->data+packet->size, TFTP_HEADER_SIZE+m_blockSize-packet->size);
+        if (readBytes > 0) {
+            packet->size += readBytes;
+            continue;
         }
-
+        /* Nothing available yet, keep what we have until there is more */
+        if (readBytes == 0 && m_streaming && !sourceAtEnd()) {
+            m_streamPacket = packet;
+            return NULL;
+        }
+        break;
     }
+    QTftpPacket::writeDataHeader(packet->data, wireBlock(m_BlockCount));
+    return packet;
 }
-void QTftp::deleteCurrentPacket()
+bool QTftp::sourceAtEnd() const
 {
-    if (m_currentPacket != NULL) {
-        delete[] m_currentPacket;
-        m_currentPacket = NULL;
-    }
-}
-void QTftp::sendNextDataPacket(QHostAddress sender, quint16 senderPort)
-{
-    //Allocate type (2B), block (2B) and payload (512B)
-    deleteCurrentPacket();
-    char *rawPacket = new char[512+4];
-    int readBytes = 0;
-    Tftp_packet_t *new_tftp_packet = (Tftp_packet_t*) rawPacket;
-    if (m_BlockCount == 1) {
-        m_currentIODevice->seek(0);
-    }
-    new_tftp_packet->type = _htons(Data);
-    new_tftp_packet->u.data.block= _htons(m_BlockCount);
-    readBytes = m_currentIODevice->read(new_tftp_packet->u.data.data, 512);
-    this->writeDatagram(rawPacket, readBytes+4, sender, senderPort);
-    emit dataTransferProgress(m_currentIODevice->pos(), m_currentIODevice->size());
-    if (readBytes < 512) {
-        changeState(Connected);
-        emit done(false);
+    /* A read of 0 only means nothing has arrived yet, the end is told by readChannelFinished() */
+    return m_streamEnded || !m_currentIODevice->isOpen();
+}
+void QTftp::sourceReadyRead()
+{
+    if (sender() != m_currentIODevice || !m_streaming)
+        return;
+    /* The first window goes out once the peer has answered the request */
+    if (m_State == Transfering && m_CurrentCommand == Write && m_windowCount < m_windowSize)
+        fillWindow();
+}
+void QTftp::sourceReadChannelFinished()
+{
+    if (sender() != m_currentIODevice || !m_streaming)
+        return;
+    m_streamEnded = true;
+    sourceReadyRead();
+}
+void QTftp::sendWindow()
+{
+    for (int i = 0; i < m_windowSent; i++) {
+        /* Karn's rule: an ACK for a resent block can't be used to measure the RTT */
+        windowEntry(i).retransmitted = true;
+        m_statistics.retransmissions++;
+    }
+    m_windowSent = 0;
+    sendPending();
+}
+void QTftp::sendPending()
+{
+    /* A burst in progress is continued by sendPaced() */
+    if (m_paceTimer->isActive())
+        return;
+    const int burst = m_pacer.burst(m_windowSize);
+    for (int i = 0; i < burst && m_windowSent < m_windowCount; i++) {
+        WindowEntry &entry = windowEntry(m_windowSent++);
+        entry.sentAt = m_clock.elapsed();
+        sendWindowEntry(entry);
     }
+    m_udpIO.flush();
+    if (m_windowSent < m_windowCount)
+        m_paceTimer->start(m_pacer.gap());
+}
+void QTftp::sendPaced()
+{
+    if (m_State != Transfering || m_CurrentCommand != Write)
+        return;
+    sendPending();
+    /* The peer can't answer before the last burst, don't count the gaps against it */
+    if (m_resentTimer->isActive())
+        m_resentTimer->start(m_rtt.rto());
+}
+void QTftp::sendWindowEntry(const QTftp::WindowEntry &entry)
+{
+    /* Leaves with the rest of its burst in sendPending() */
+    if (entry.packet != NULL) {
+        m_statistics.packetsSent++;
+        m_statistics.bytesSent += entry.packet->size;
+        m_udpIO.queueDatagram(entry.packet->data, entry.packet->size, NULL, 0, m_currentTarget, m_currentPort);
+        return;
+    }
+    m_statistics.packetsSent++;
+    m_statistics.bytesSent += sizeof(entry.header)+entry.payloadSize;
+    m_udpIO.queueDatagram(entry.header, sizeof(entry.header), entry.payload, entry.payloadSize,
+                          m_currentTarget, m_currentPort);
+}
+void QTftp::arm()
+{
+    m_armedSince = m_armedInterval > 0 ? m_clock.elapsed() : -1;
+}
+void QTftp::probeArmed()
+{
+    if (m_armedTimeout > 0 && m_clock.elapsed() - m_armedSince >= m_armedTimeout) {
+        m_armedSince = -1;
+        m_resentTimer->stop();
+        emit error(TransmissionTimedOut, tr("The device did not answer"));
+        emit done(true);
+        return;
+    }
+    /* Not a retransmission: the device most likely never saw the last one */
+    if (m_currentPacket != NULL)
+        sendDatagram(m_currentPacket->data, m_currentPacket->size, m_currentTarget, m_currentPort);
+    m_resentTimer->start(m_armedInterval);
+}
+void QTftp::armRetransmitTimer()
+{
+    m_resentCount = 0;
+    m_resentTimer->start(m_rtt.rto());
+}
+void QTftp::addRttSample(qint64 rtt)
+{
+    m_rtt.addSample(rtt);
+    m_statistics.addRttSample(rtt);
+}
+void QTftp::sampleProbe()
+{
+    if (m_probeSentAt >= 0)
+        addRttSample(m_clock.elapsed() - m_probeSentAt);
+    m_probeSentAt = -1;
 }
 
 void QTftp::retransmitPacket()
 {
-    if (m_resentCount > 3) {
+    if (isArmed()) {
+        probeArmed();
+        return;
+    }
+    if (m_multicastServer && m_resentCount >= m_maxRetries) {
+        /* Only give up on the master, the rest of the group may still listen */
+        finishMulticastClient(true);
+        return;
+    }
+    if (m_resentCount >= m_maxRetries) {
         m_resentTimer->stop();
         emit error(TransmissionTimedOut,tr("Transmission timed out"));
         emit done(true);
+        return;
     }
-    m_udpSocket->writeDatagram(m_currentPacket, m_currentSize , m_currentTarget, m_currentPort);
     m_resentCount++;
+    m_probeSentAt = -1;
+    m_rtt.backoff();
+    m_resentTimer->start(m_rtt.rto());
+    if (m_State == Transfering && m_CurrentCommand == Write) {
+        /* Go back to the first unacknowledged block */
+        m_pacer.lossDetected(m_windowSize);
+        sendWindow();
+        return;
+    }
+    if (m_State == Transfering && m_CurrentCommand == Read && m_blocksSinceAck > 0) {
+        /* The rest of the window got lost, acknowledge what we have so far */
+        int resentCount = m_resentCount;
+        int rto = m_rtt.rto();
+        m_blocksSinceAck = 0;
+        m_statistics.retransmissions++;
+        sendAcknowledgment(wireBlock(m_BlockCount-1), m_currentTarget, m_currentPort);
+        m_resentCount = resentCount;
+        m_probeSentAt = -1;
+        m_resentTimer->start(rto);
+        return;
+    }
+    if (m_currentPacket != NULL) {
+        m_statistics.retransmissions++;
+        sendDatagram(m_currentPacket->data, m_currentPacket->size, m_currentTarget, m_currentPort);
+    }
 }
-void QTftp::handleAcknowledgment(QByteArray packet, QHostAddress sender, quint16 senderPort)
+void QTftp::handleAcknowledgment(const char *packet, int size, const QHostAddress &sender, quint16 senderPort)
 {
-    Tftp_packet_t *tftp_packet = (Tftp_packet_t*) packet.data();
-    if (_ntohs(tftp_packet->u.data.block) == m_BlockCount) {
-        if (m_BlockCount == 0)
-            changeState(Transfering);
-        m_BlockCount++;
+    quint16 block;
+    if (!QTftpPacket::parseAcknowledgment(packet, size, &block) || m_CurrentCommand != Write)
+        return;
+    if (m_multicastServer) {
+        handleMulticastAcknowledgment(block, sender, senderPort);
+        return;
+    }
+    if (m_State == Connected && m_BlockCount == 0) {
+        /* ACK 0 answers our WRQ, the peer ignored all options */
+        if (block == 0) {
+            m_armedSince = -1;
+            m_resentTimer->stop();
+            sampleProbe();
+            startUpload(sender, senderPort);
+        }
+        return;
+    }
+    if (m_State != Transfering || m_windowCount == 0)
+        return;
+    if (sender != m_currentTarget || senderPort != m_currentPort) {
+        /* E.g. the answer to an earlier WRQ of armed mode (RFC 1350 section 4) */
+        sendErrorPacket(UnknownTransferID, tr("Unknown transfer ID"), sender, senderPort);
+        return;
+    }
+    acknowledgeWindow(block);
+}
+void QTftp::handleMulticastAcknowledgment(quint16 block, const QHostAddress &sender, quint16 senderPort)
+{
+    if (m_multicastClients.isEmpty())
+        return;
+    const quint16 lastBlock = m_sourceImage.size() / m_blockSize + 1;
+    const MulticastClient &master = m_multicastClients.first();
+    if (sender != master.address || senderPort != master.port) {
+        /* Clients that got everything before becoming master say goodbye, see handleMulticastData() */
+        if (block != lastBlock)
+            return;
+        for (int i = 1; i < m_multicastClients.size(); i++) {
+            if (m_multicastClients.at(i).address == sender && m_multicastClients.at(i).port == senderPort) {
+                m_multicastClients.removeAt(i);
+                emit multicastClientFinished(sender, senderPort, false);
+                break;
+            }
+        }
+        return;
+    }
+    if (block == lastBlock) {
+        /* The master has it all, the next client gets to ask for what it missed */
+        finishMulticastClient(false);
+        return;
+    }
+    const qint64 acked = blockFromWire(block, m_windowFirstBlock) - m_windowFirstBlock + 1;
+    if (m_State == Transfering && acked >= 0 && acked <= m_windowCount) {
+        acknowledgeWindow(block);
+        return;
+    }
+    /*
+     * A new master answers its OACK with the last block it has in sequence,
+     * which may be anywhere in the file. Continue the stream from there.
+     */
+    m_resentTimer->stop();
+    sampleProbe();
+    startUpload(m_multicastGroup, m_multicastPort, block+1);
+}
+void QTftp::acknowledgeWindow(quint16 block)
+{
+    /* ACKs are cumulative, everything up to block has arrived */
+    const qint64 acked = blockFromWire(block, m_windowFirstBlock) - m_windowFirstBlock + 1;
+    if (acked == 0) {
+        m_statistics.duplicates++;
+        /*
+         * A duplicate of the previous ACK: the peer timed out waiting for
+         * m_windowFirstBlock. Resend without waiting for our own timeout,
+         * unless the duplicate may answer a copy we sent ourselves. Resending
+         * on those would answer every duplicate DATA with one more, a
+         * Sorcerer's Apprentice storm (RFC 1123 4.2.3.1).
+         */
+        if (isSpuriousDuplicate())
+            return;
+        if (m_fastRetransmitted) {
+            m_fastRetransmitted = false;
+            return;
+        }
+        m_fastRetransmitted = true;
+        m_probeSentAt = -1;
+        m_pacer.lossDetected(m_windowSize);
+        sendWindow();
+        m_resentTimer->start(m_rtt.rto());
+        return;
+    }
+    if (acked < 0 || acked > m_windowCount)
+        return;
+    const WindowEntry &last = windowEntry(acked-1);
+    const bool clean = !last.retransmitted;
+    if (clean)
+        addRttSample(m_clock.elapsed() - last.sentAt);
+    for (qint64 i = 0; i < acked; i++) {
+        m_statistics.payloadBytes += windowEntry(0).payloadSize;
+        m_pool.release(windowEntry(0).packet);
+        windowEntry(0).packet = NULL;
+        m_windowHead = (m_windowHead + 1) % m_window.size();
+        m_windowCount--;
+    }
+    m_windowFirstBlock += acked;
+    m_ackedRetransmitted = !clean;
+    /* Blocks of an earlier round may be acknowledged while a resent window waits for its burst */
+    m_windowSent = qMax((qint64) 0, m_windowSent - acked);
+    if (m_windowCount == 0 && clean)
+        m_pacer.windowAcknowledged(m_windowSize);
+    else if (m_windowSent > 0)
+        m_pacer.lossDetected(m_windowSize);
+    if (m_windowCount == 0 && m_sourceFinished) {
         m_resentTimer->stop();
-        if (m_State == Transfering)
-            sendNextDataPacket(sender, senderPort);
+        reportUploadProgress(true);
+        changeState(Connected);
+        emit done(false);
+        return;
+    }
+    /* The peer stopped in the middle of the window, continue right behind its ACK */
+    if (m_windowCount > 0)
+        m_fastRetransmitted = true;
+    sendWindow();
+    fillWindow();
+}
+bool QTftp::isSpuriousDuplicate() const
+{
+    /* Nothing of this window is out yet, or it went out again already */
+    if (m_windowSent == 0 || windowEntry(0).retransmitted)
+        return true;
+    /* The window it acknowledges held a resent block, so it was received twice */
+    if (m_ackedRetransmitted)
+        return true;
+    /* Sent within about one RTT, the duplicate crossed it on the way */
+    const int rtt = m_rtt.smoothedRtt() >= 0 ? m_rtt.smoothedRtt() : m_rtt.rto();
+    return m_clock.elapsed() - windowEntry(0).sentAt <= rtt;
+}
+void QTftp::sendAcknowledgment(quint16 block, const QHostAddress &host, quint16 port)
+{
+    releaseCurrentPacket();
+    QTftpPacketBuffer *rawPacket = m_pool.acquire(TFTP_HEADER_SIZE);
+    rawPacket->size = QTftpPacket::writeAcknowledgment(rawPacket->data, block);
+    this->writeDatagram(rawPacket, host, port);
+}
+void QTftp::sendErrorPacket(QTftp::TFtpErrorCode code, const QString &message, const QHostAddress &host, quint16 port)
+{
+    /* Error packets are never retransmitted, so no need to keep them around */
+    QTftpPacketBuffer *rawPacket = m_pool.acquire(TFTP_SMALL_PACKET_SIZE);
+    rawPacket->size = QTftpPacket::writeError(rawPacket->data, TFTP_SMALL_PACKET_SIZE, code, message);
+    sendDatagram(rawPacket->data, rawPacket->size, host, port);
+    m_pool.release(rawPacket);
+}
+void QTftp::handleOptionAcknowledgment(const char *packet, int size, const QHostAddress &sender, quint16 senderPort)
+{
+    if (m_multicastSocket != NULL) {
+        handleMulticastOptionAcknowledgment(packet, size, sender, senderPort);
+        return;
+    }
+    /* An OACK is only valid as the very first answer to a request with options */
+    if (m_State != Connected || !m_optionsSent)
+        return;
+    if ((m_CurrentCommand == Read && m_BlockCount != 1) || (m_CurrentCommand == Write && m_BlockCount != 0))
+        return;
+    m_armedSince = -1;
+    m_resentTimer->stop();
+    sampleProbe();
+    quint16 blockSize = TFTP_DEFAULT_BLOCKSIZE;
+    quint16 windowSize = TFTP_DEFAULT_WINDOWSIZE;
+    qint64 transferSize = m_transferSize;
+    int timeout = 0;
+    bool multicast = false;
+    QHostAddress group;
+    quint16 groupPort = 0;
+    bool master = false;
+    /* name\0value\0 pairs following the opcode */
+    QTftpPacketString name;
+    QTftpPacketString value;
+    int offset = 2;
+    while (QTftpPacket::nextOption(packet, size, &offset, &name, &value)) {
+        quint64 number = 0;
+        if (name.equals("blksize")) {
+            if (!value.toNumber(m_requestedBlockSize, &number) || number < TFTP_MIN_BLOCKSIZE) {
+                sendErrorPacket(OptionNegotiationFailed, tr("Invalid blksize"), sender, senderPort);
+                emit error(ProtocolError, tr("Peer answered with an invalid block size"));
+                emit done(true);
+                return;
+            }
+            blockSize = number;
+        } else if (name.equals("windowsize")) {
+            if (!value.toNumber(m_requestedWindowSize, &number) || number < TFTP_DEFAULT_WINDOWSIZE) {
+                sendErrorPacket(OptionNegotiationFailed, tr("Invalid windowsize"), sender, senderPort);
+                emit error(ProtocolError, tr("Peer answered with an invalid window size"));
+                emit done(true);
+                return;
+            }
+            windowSize = number;
+        } else if (name.equals("tsize")) {
+            if (!value.toNumber(Q_INT64_C(0x7fffffffffffffff), &number)) {
+                sendErrorPacket(OptionNegotiationFailed, tr("Invalid tsize"), sender, senderPort);
+                emit error(ProtocolError, tr("Peer answered with an invalid transfer size"));
+                emit done(true);
+                return;
+            }
+            /* On uploads the peer just echoes our size */
+            if (m_CurrentCommand == Read)
+                transferSize = number;
+        } else if (name.equals("timeout")) {
+            /* The peer has to accept the timeout as is or leave it out */
+            if (!value.toNumber(TFTP_MAX_TIMEOUT, &number) || (int) number != m_requestedTimeout) {
+                sendErrorPacket(OptionNegotiationFailed, tr("Invalid timeout"), sender, senderPort);
+                emit error(ProtocolError, tr("Peer answered with an invalid timeout"));
+                emit done(true);
+                return;
+            }
+            timeout = number;
+        } else if (name.equals("multicast") && m_multicastSent) {
+            if (!parseMulticastOption(QByteArray::fromRawData(value.data, value.size), &group, &groupPort, &master)
+                    || group.isNull() || groupPort == 0) {
+                sendErrorPacket(OptionNegotiationFailed, tr("Invalid multicast"), sender, senderPort);
+                emit error(ProtocolError, tr("Peer answered with an invalid multicast group"));
+                emit done(true);
+                return;
+            }
+            multicast = true;
+        }
+    }
+    m_blockSize = blockSize;
+    m_windowSize = windowSize;
+    m_transferSize = transferSize;
+    m_timeout = timeout;
+    m_rtt.setAgreedTimeout(timeout * 1000);
+    m_udpIO.setDatagramSize(TFTP_HEADER_SIZE+m_blockSize);
+    m_multicastIO.setDatagramSize(TFTP_HEADER_SIZE+m_blockSize);
+    if (m_CurrentCommand == Write) {
+        /* The OACK replaces ACK 0 */
+        startUpload(sender, senderPort);
+    } else {
+        changeState(Transfering);
+        if (!m_currentIODevice->isSequential())
+            m_currentIODevice->seek(0);
+        m_meter.start();
+        prepareSink();
+        if (!multicast) {
+            sendAcknowledgment(0, sender, senderPort);
+            return;
+        }
+        if (!joinMulticastGroup(group, groupPort)) {
+            sendErrorPacket(OptionNegotiationFailed, tr("Unable to join the multicast group"), sender, senderPort);
+            emit error(UnknownError, tr("Unable to join the multicast group ") + group.toString());
+            emit done(true);
+            return;
+        }
+        m_multicastSender = sender;
+        m_multicastSenderPort = senderPort;
+        m_multicastMaster = master;
+        m_multicastReceived.clear();
+        m_multicastFirstMissing = 1;
+        m_multicastLastBlock = m_transferSize >= 0 ? m_transferSize / m_blockSize + 1 : -1;
+        m_blocksSinceAck = 0;
+        m_gapAcked = false;
+        if (master)
+            sendAcknowledgment(0, sender, senderPort);
+        else
+            armRetransmitTimer();
+    }
+}
+bool QTftp::parseMulticastOption(const QByteArray &value, QHostAddress *group, quint16 *port, bool *master)
+{
+    /* "addr,port,mc", a new master may get ",,1" (RFC 2090) */
+    QList<QByteArray> fields = value.split(',');
+    if (fields.size() != 3)
+        return false;
+    if (!fields.at(0).isEmpty() && !group->setAddress(QString::fromLatin1(fields.at(0))))
+        return false;
+    if (!fields.at(1).isEmpty()) {
+        bool ok = false;
+        *port = fields.at(1).toUShort(&ok);
+        if (!ok)
+            return false;
+    }
+    if (fields.at(2) != "0" && fields.at(2) != "1")
+        return false;
+    *master = fields.at(2) == "1";
+    return true;
+}
+bool QTftp::joinMulticastGroup(const QHostAddress &group, quint16 port)
+{
+    leaveMulticastGroup();
+    m_multicastSocket = new QUdpSocket(this);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    const QHostAddress any(group.protocol() == QAbstractSocket::IPv6Protocol ? QHostAddress::AnyIPv6 : QHostAddress::AnyIPv4);
+#else
+    const QHostAddress any(group.protocol() == QAbstractSocket::IPv6Protocol ? QHostAddress::AnyIPv6 : QHostAddress::Any);
+#endif
+    /* All clients of the group on this host share the port */
+    bool joined = m_multicastSocket->bind(any, port, QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint);
+    if (joined && m_multicastInterface.isValid())
+        joined = m_multicastSocket->joinMulticastGroup(group, m_multicastInterface);
+    else if (joined)
+        joined = m_multicastSocket->joinMulticastGroup(group);
+    if (!joined) {
+        leaveMulticastGroup();
+        return false;
+    }
+    m_multicastIO.setSocket(m_multicastSocket);
+    m_multicastIO.setDatagramSize(m_udpIO.datagramSize());
+    connect(m_multicastSocket, SIGNAL(readyRead()), this, SLOT(readPendingDatagrams()));
+    return true;
+}
+void QTftp::leaveMulticastGroup()
+{
+    if (m_multicastSocket == NULL)
+        return;
+    /* Closing leaves the group, we may be called from within its readyRead() */
+    m_multicastSocket->disconnect(this);
+    m_multicastIO.setSocket(NULL);
+    m_multicastSocket->close();
+    m_multicastSocket->deleteLater();
+    m_multicastSocket = NULL;
+    m_multicastReceived.clear();
+    m_multicastMaster = false;
+}
+void QTftp::handleMulticastOptionAcknowledgment(const char *packet, int size, const QHostAddress &sender, quint16 senderPort)
+{
+    /* Only the server's TID may make us master (or take it back) */
+    if (m_State != Transfering || sender != m_multicastSender || senderPort != m_multicastSenderPort)
+        return;
+    QHostAddress group;
+    quint16 groupPort = 0;
+    bool master = false;
+    bool multicast = false;
+    quint16 windowSize = m_windowSize;
+    QTftpPacketString name;
+    QTftpPacketString value;
+    int offset = 2;
+    while (QTftpPacket::nextOption(packet, size, &offset, &name, &value)) {
+        if (name.equals("multicast")) {
+            multicast = parseMulticastOption(QByteArray::fromRawData(value.data, value.size), &group, &groupPort, &master);
+        } else if (name.equals("windowsize")) {
+            /* The group window follows the slowest client, see QTftp::addMulticastClient() */
+            quint64 number = 0;
+            if (value.toNumber(m_requestedWindowSize, &number) && number >= TFTP_DEFAULT_WINDOWSIZE)
+                windowSize = number;
+        }
     }
+    if (!multicast)
+        return;
+    sampleProbe();
+    m_multicastMaster = master;
+    if (!master) {
+        /* The answer to our repeated RRQ, the server still knows us */
+        armRetransmitTimer();
+        return;
+    }
+    m_windowSize = windowSize;
+    m_blocksSinceAck = 0;
+    m_gapAcked = false;
+    /* Tell the server where to continue for us */
+    sendAcknowledgment(m_multicastFirstMissing-1, sender, senderPort);
 }
-void QTftp::sendAcknowledgment(QHostAddress host, quint16 port)
+void QTftp::handleMulticastData(const char *data, int size, quint16 block)
 {
-    deleteCurrentPacket();
-    char *rawPacket = new char[2+2];
-    Tftp_packet_t *Tftp_packet = (Tftp_packet_t*) rawPacket;
-    Tftp_packet->type = _htons(Acknowledgment);
-    Tftp_packet->u.ack.block = _htons(m_BlockCount);
-    this->writeDatagram(rawPacket, 2+2 , host, port);
+    if (block == 0 || size > m_blockSize || (m_multicastLastBlock >= 0 && block > m_multicastLastBlock))
+        return;
+    const bool duplicate = block <= m_multicastReceived.size() && m_multicastReceived.testBit(block-1);
+    const bool inSequence = block == m_multicastFirstMissing;
+    if (duplicate) {
+        m_statistics.duplicates++;
+    } else {
+        if (block > m_multicastReceived.size())
+            m_multicastReceived.resize(qMax<int>(block, 2*m_multicastReceived.size()));
+        m_multicastReceived.setBit(block-1);
+        writeSinkAt((qint64) (block-1) * m_blockSize, data, size);
+        m_transferred += size;
+        m_statistics.payloadBytes += size;
+        if (size < m_blockSize)
+            m_multicastLastBlock = block;
+        while (m_multicastFirstMissing <= m_multicastReceived.size()
+               && m_multicastReceived.testBit(m_multicastFirstMissing-1))
+            m_multicastFirstMissing++;
+    }
+    /* retransmitPacket() acknowledges m_BlockCount-1 */
+    m_BlockCount = m_multicastFirstMissing;
+    const bool complete = m_multicastLastBlock >= 0 && m_multicastFirstMissing > m_multicastLastBlock;
+    if (!duplicate)
+        reportProgress(m_transferred, qMax(m_transferSize, (qint64) 0), complete);
+    if (complete) {
+        /*
+         * The master's last ACK tells the server it is done. Others say
+         * goodbye the same way, so the server doesn't have to time out on
+         * them once it makes them master.
+         */
+        char ack[TFTP_HEADER_SIZE];
+        sendDatagram(ack, QTftpPacket::writeAcknowledgment(ack, m_multicastLastBlock),
+                     m_multicastSender, m_multicastSenderPort);
+        m_resentTimer->stop();
+        changeState(Connected);
+        emit done(false);
+        return;
+    }
+    if (!m_multicastMaster) {
+        /* Just listening, the repeated RRQ checks whether the server still knows us */
+        armRetransmitTimer();
+        return;
+    }
+    sampleProbe();
+    /* Blocks we already had count as well, the server sends whole windows */
+    m_blocksSinceAck++;
+    if (!duplicate && !inSequence && !m_gapAcked) {
+        /* Something in front of it got lost, tell the server once where to continue */
+        m_gapAcked = true;
+        m_blocksSinceAck = 0;
+        sendAcknowledgment(m_multicastFirstMissing-1, m_multicastSender, m_multicastSenderPort);
+        return;
+    }
+    if (inSequence)
+        m_gapAcked = false;
+    if (m_blocksSinceAck >= m_windowSize) {
+        m_blocksSinceAck = 0;
+        sendAcknowledgment(m_multicastFirstMissing-1, m_multicastSender, m_multicastSenderPort);
+    } else {
+        armRetransmitTimer();
+    }
 }
 void QTftp::initSocket()
 {
@@ -335,41 +1485,54 @@ void QTftp::initSocket()
         if (m_udpSocket != NULL)
             delete m_udpSocket;
         m_udpSocket = new QUdpSocket(this);
-        m_udpSocket->bind(7755);
+        m_udpIO.setSocket(m_udpSocket);
+        /* Every session gets its own ephemeral port, which is its TID (RFC 1350) */
+        m_udpSocket->bind();
         connect(m_udpSocket, SIGNAL(readyRead()), this, SLOT(readPendingDatagrams()));
         this->changeState(Unconnected);
     }
 }
 void QTftp::changeState(QTftp::State state)
 {
+    const qint64 now = m_clock.elapsed();
+    m_statistics.timeInState[m_State] += now - m_stateSince;
+    m_stateSince = now;
     m_State = state;
     emit stateChanged(m_State);
 }
 
-void QTftp::processTftpPacket(QByteArray packet, QHostAddress sender, quint16 senderPort)
+void QTftp::processTftpPacket(const char *packet, int size, const QHostAddress &sender, quint16 senderPort)
 {
-    Tftp_packet_t *tftp_packet = (Tftp_packet_t*) packet.data();
-    switch (_ntohs(tftp_packet->type)) {
+    /* Everything but an OACK carries at least a block number or error code */
+    const quint16 type = QTftpPacket::opCode(packet, size);
+    if (size < TFTP_HEADER_SIZE && type != OptionAcknowledgment) {
+        tftpPacketDebug() << "Truncated packet from" << sender.toString() << senderPort;
+        return;
+    }
+    switch (type) {
     case Acknowledgment:
-        qDebug() << "ACK Received";
-        handleAcknowledgment(packet, sender, senderPort);
+        tftpPacketDebug() << "ACK" << QTftpPacket::read16(packet+2);
+        handleAcknowledgment(packet, size, sender, senderPort);
         break;
-    case Read:
-        qDebug() << "RRQ Received";
-        break;
-    case Write:
-        qDebug() << "WRQ Received";
+    case ReadRequest:
+    case WriteRequest:
+        /* Requests go to QTftpServer, a session never expects one */
+        tftpPacketDebug() << "Request from" << sender.toString() << senderPort;
         break;
     case Error:
-        qDebug() << "Error Received";
-        handleError(packet, sender, senderPort);
+        tftpPacketDebug() << "ERROR" << QTftpPacket::read16(packet+2);
+        handleError(packet, size, sender, senderPort);
         break;
     case Data:
-        handleData(packet, sender, senderPort);
-        qDebug() << "Data Received";
+        tftpPacketDebug() << "DATA" << QTftpPacket::read16(packet+2) << size-TFTP_HEADER_SIZE;
+        handleData(packet, size, sender, senderPort);
+        break;
+    case OptionAcknowledgment:
+        tftpPacketDebug() << "OACK";
+        handleOptionAcknowledgment(packet, size, sender, senderPort);
         break;
     default:
-        qDebug() << "Error: Malformed packet received with an unknown type";
+        tftpPacketDebug() << "Unknown packet type" << type;
     }
 }
 
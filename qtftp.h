@@ -20,8 +20,8 @@
  * from Qt's QFTP class.
  * Source: http://qt.gitorious.org/qt/qt/blobs/4.8/src/network/access/qftp.h
  *
- * Note that this implementation currently only can handle one connection and one
- * command at a time. NetAscii and Mail are also unsupported.
+ * Note that one QTftp object only handles one connection and one command at a time,
+ * QTftpSessionManager runs many of them in parallel. NetAscii and Mail are unsupported.
  *
  */
 
@@ -29,17 +29,51 @@
 #define QTFTP_H
 #include <QObject>
 #include <QIODevice>
+#include <QFile>
+#include <QBitArray>
+#include <QList>
+#include <QNetworkInterface>
 #include <QString>
 #include <QUdpSocket>
 #include <QHostAddress>
 #include <QHostInfo>
 #include <QTimer>
-#include <stdint.h>
+#include <QElapsedTimer>
+#include "qtftprttestimator.h"
+#include "qtftppacketpool.h"
+#include "qtftpimage.h"
+#include "qtftpprogress.h"
+#include "qtftpstatistics.h"
+#include "qtftpbatchio.h"
+#include "qtftppacket.h"
+#include "qtftphashsink.h"
+#include "qtftppacer.h"
+#include "qtftptimerwheel.h"
 
 #define NETASCII "NetAscii"
 #define OCTET "Octet"
 #define MAIL "Mail"
 
+#define TFTP_DEFAULT_BLOCKSIZE 512
+#define TFTP_MIN_BLOCKSIZE 8
+#define TFTP_MAX_BLOCKSIZE 65464
+/* Fits into a 1500 byte MTU and leaves some room for tunnel headers */
+#define TFTP_ETHERNET_BLOCKSIZE 1428
+/* RFC 7440, a window of one block is plain lock-step RFC 1350 */
+#define TFTP_DEFAULT_WINDOWSIZE 1
+#define TFTP_PIPELINE_WINDOWSIZE 8
+/* RFC 2349, in seconds */
+#define TFTP_MAX_TIMEOUT 255
+/* Retransmissions of a packet before the transfer is given up */
+#define TFTP_DEFAULT_RETRIES 5
+/* WRQ resend interval and overall wait (ms) while armed, see setArmedMode() */
+#define TFTP_DEFAULT_ARMED_INTERVAL 50
+#define TFTP_DEFAULT_ARMED_TIMEOUT 60000
+/* Block number following 65535, most servers and clients wrap to 0 */
+#define TFTP_DEFAULT_BLOCK_WRAP 0
+/* RFC 2090 ACKs carry 16 bit block numbers, so bigger files are never multicast */
+#define TFTP_MULTICAST_MAX_BLOCKS 0xffff
+
 class QTftp : public QObject
 {
     Q_OBJECT
@@ -47,28 +81,6 @@ public:
     explicit QTftp(QObject *parent = 0);
     virtual ~QTftp();
 
-    struct Tftp_packet_t {
-        uint16_t type;
-        union {
-            // This will be used for RRQ and WRQ packets due to their diffrent length - OP codes 1 and 2
-            char raw[0];
-            // Data packet - OP code 3
-            struct {
-                uint16_t block;
-                char data[0];
-            } data;
-            // ACK packet - OP code 4
-            struct {
-                uint16_t block;
-            } ack;
-            // Error packet - OP code 5
-            struct {
-                uint16_t code;
-                char message[1];
-            } error;
-        } u;
-    };
-
     enum TFtpErrorCode {
         NotDefined,
         FileNotFound,
@@ -77,7 +89,8 @@ public:
         IllegalOP,
         UnknownTransferID,
         FileExists,
-        NoSuchUser
+        NoSuchUser,
+        OptionNegotiationFailed
     };
 
     enum OpCode {
@@ -85,7 +98,8 @@ public:
         WriteRequest = 2,
         Data = 3,
         Acknowledgment = 4,
-        Error = 5
+        Error = 5,
+        OptionAcknowledgment = 6
     };
 
     enum State {
@@ -120,21 +134,204 @@ public:
     void disconnectFromHost();
     int close();
     int get(const QString &file, QIODevice *dev=0, TransferType type = Octet);
+    /*
+     * A sequential dev (QProcess, socket, QTftpPipeReader) is streamed: blocks
+     * go out as they become available, without tsize, and progress has no
+     * total. dev must not block in read(), a QFile on a pipe does.
+     */
     int put(QIODevice *dev, const QString &file, TransferType type = Octet);
+    /* data is implicitly shared, not copied */
     int put(const QByteArray &data, const QString &file, TransferType type = Octet);
+    /* Sends the blocks straight out of the (shared) image, see QTftpImage */
+    int put(const QTftpImage &image, const QString &file, TransferType type = Octet);
+    /*
+     * Server side of a read request, used by QTftpServer: uploads image to the
+     * client that sent the RRQ. If options were accepted, optionAck holds the
+     * name\0value\0 pairs for the OACK and the transfer starts with its ACK.
+     * timeout is the agreed timeout in seconds, 0 if the client didn't ask.
+     */
+    int serve(const QHostAddress &client, quint16 port, const QTftpImage &image,
+              quint16 blockSize, quint16 windowSize, int timeout, const QByteArray &optionAck);
+    /*
+     * Server side of multicast read requests (RFC 2090), used by QTftpServer.
+     * DATA goes to group:groupPort out of iface (the default one if invalid),
+     * ACKs are only taken from the master client, see addMulticastClient().
+     */
+    int serveMulticast(const QHostAddress &group, quint16 groupPort, const QNetworkInterface &iface,
+                       const QTftpImage &image, quint16 blockSize, int timeout);
+    /*
+     * Sends a client of serveMulticast() its OACK, options holding all pairs
+     * but windowsize and multicast. The first client left is the master. Each
+     * time a new master is chosen, the window shrinks to the smallest
+     * windowSize of all clients still in the group. Calling this again for a
+     * known client just repeats its OACK.
+     */
+    void addMulticastClient(const QHostAddress &client, quint16 port, quint16 windowSize, const QByteArray &options);
     QTftp::ErrorCode getLastErrorCode() {
         return m_LastError;
     }
     QString getLastErrorMessage() {
         return m_LastErrorMessage;
     }
+    quint16 localPort() const {
+        return m_udpSocket != NULL ? m_udpSocket->localPort() : 0;
+    }
+    /*
+     * Block size to request (RFC 2348) with the next get() or put().
+     * 512 disables the option. blockSize() returns the negotiated size,
+     * which falls back to 512 if the peer ignores the option.
+     */
+    void setBlockSize(quint16 size);
+    quint16 blockSize() const {
+        return m_blockSize;
+    }
+    quint16 requestedBlockSize() const {
+        return m_requestedBlockSize;
+    }
+    /*
+     * Number of blocks sent before waiting for an ACK (RFC 7440). 1 disables
+     * the option, windowSize() is 1 unless the peer agreed on more.
+     */
+    void setWindowSize(quint16 size);
+    quint16 windowSize() const {
+        return m_windowSize;
+    }
+    quint16 requestedWindowSize() const {
+        return m_requestedWindowSize;
+    }
+    /*
+     * The retransmission timeout follows the measured round trip time and
+     * doubles with every retransmission, always staying within these bounds (ms).
+     */
+    void setRetransmitTimeout(int minimum, int maximum);
+    /* Timeout until the first RTT sample, 0 restores TFTP_INITIAL_RTO (ms) */
+    void setInitialRetransmitTimeout(int timeout);
+    void setMaxRetries(int retries);
+    int maxRetries() const {
+        return m_maxRetries;
+    }
+    /*
+     * Sends at most burst DATA packets of a window back to back and waits
+     * gap ms before the next ones, see QTftpPacer. 0 for either sends whole
+     * windows at once. With autoTune the values adapt to the losses of the
+     * transfer and pacingBurst() and pacingGap() tell where they ended up,
+     * both are 0 while whole windows go out.
+     */
+    void setPacing(int burst, int gap, bool autoTune = false);
+    int pacingBurst() const {
+        return m_pacer.isPacing(m_windowSize) ? m_pacer.burst(m_windowSize) : 0;
+    }
+    int pacingGap() const {
+        return m_pacer.isPacing(m_windowSize) ? m_pacer.gap() : 0;
+    }
+    bool pacingAutoTune() const {
+        return m_pacer.autoTune();
+    }
+    /*
+     * Timeout in seconds to propose to the peer (RFC 2349), 0 disables the
+     * option. An agreed timeout caps the retransmission timeout, see
+     * QTftpRttEstimator::setAgreedTimeout(). timeoutInterval() is 0 unless
+     * the peer agreed.
+     */
+    void setTimeoutInterval(int seconds);
+    int timeoutInterval() const {
+        return m_timeout;
+    }
+    /*
+     * Size of the file being transferred, announced with the tsize option
+     * (RFC 2349) on downloads. -1 as long as it is unknown.
+     */
+    qint64 transferSize() const {
+        return m_transferSize;
+    }
+    /*
+     * Downloads into a QFile of known size resize it up front. With this
+     * enabled (the default) the blocks are then copied into a mapping of the
+     * file, which needs it to be opened ReadWrite.
+     */
+    void setMappedDownloads(bool enabled) {
+        m_mappedDownloads = enabled;
+    }
+    bool mappedDownloads() const {
+        return m_mappedDownloads;
+    }
+    /*
+     * Hashes every block of a put() the first time it is sent, so the upload
+     * can be compared with a read back into a QTftpHashSink without reading
+     * the source twice. sourceHash() is complete once done(false).
+     */
+    void setSourceHashing(bool enabled) {
+        m_sourceHashing = enabled;
+    }
+    QByteArray sourceHash() const {
+        return m_sourceHashing ? m_sourceHash.result() : QByteArray();
+    }
+    /*
+     * Armed mode for devices that only listen for a moment after a reset,
+     * like the Ethersex bootloader: put() resends its WRQ every interval ms
+     * until the device answers and then starts right away. Unanswered
+     * requests don't count as retries, timeout limits the wait in ms and 0
+     * waits until abort(). An interval of 0 (the default) disables it.
+     */
+    void setArmedMode(int interval, int timeout = TFTP_DEFAULT_ARMED_TIMEOUT);
+    int armedInterval() const {
+        return m_armedInterval;
+    }
+    /* A put() is waiting for the first answer of the device */
+    bool isArmed() const {
+        return m_armedSince >= 0;
+    }
+    /*
+     * Ask for multicast (RFC 2090) with the next get(). If the server agrees,
+     * the blocks are received from its group on iface (the default one if
+     * invalid) in any order, and the missing ones are asked for once the
+     * server makes us master client. Sequential devices never ask.
+     */
+    void setMulticast(bool enabled, const QNetworkInterface &iface = QNetworkInterface());
+    bool multicast() const {
+        return m_multicastRequested;
+    }
+    /* The current download is received from a multicast group */
+    bool isMulticastMember() const {
+        return m_multicastSocket != NULL;
+    }
+    /*
+     * Block number that follows 65535 on the wire, 0 or 1. Transfers of
+     * more blocks only work if the peer wraps the same way, internally
+     * blocks are counted with 64 bits and never wrap.
+     */
+    void setBlockWrap(quint16 block);
+    quint16 blockWrap() const {
+        return m_blockWrap;
+    }
+    /* Minimum time between two progress reports in ms, see QTftpProgressMeter */
+    void setProgressInterval(int interval) {
+        m_meter.setInterval(interval);
+    }
+    /* Packets sent again during the current transfer */
+    int retransmissions() const {
+        return m_statistics.retransmissions;
+    }
+    /* Counters of the current or last transfer, reset by every command */
+    QTftpStatistics statistics() const;
+    /* Current timeout and smoothed round trip time (-1 without a sample), in ms */
+    int retransmitTimeout() const {
+        return m_rtt.rto();
+    }
+    int smoothedRtt() const {
+        return m_rtt.smoothedRtt();
+    }
 
 signals:
     void stateChanged(QTftp::State state);
+    /* Both are rate limited to one report per progress interval */
     void dataTransferProgress(qint64 done, qint64 total);
+    void progress(const QTftpProgress &progress);
     void done(bool error);
     void readyRead();
     void error(QTftp::ErrorCode, const QString&);
+    /* A client of serveMulticast() got the whole file or was given up */
+    void multicastClientFinished(const QHostAddress &client, quint16 port, bool error);
 
 public slots:
     void abort();
@@ -145,32 +342,178 @@ private slots:
     void retransmitPacket();
     void stop(bool error);
     void setError(QTftp::ErrorCode errorCode, const QString &errorMessage);
+    void sourceReadyRead();
+    void sourceReadChannelFinished();
+    void sendPaced();
 
 private:
     void initSocket();
-    void deleteCurrentPacket();
+    void releaseCurrentPacket();
+    void clearWindow();
     void changeState(State state);
-    void processTftpPacket(QByteArray packet, QHostAddress sender, quint16 senderPort);
-    void writeDatagram(char *payload, quint16 size, QHostAddress sender, quint16 senderPort);
-    void sendNextDataPacket(QHostAddress sender, quint16 senderPort);
-    void sendAcknowledgment(QHostAddress host, quint16 port);
-    void handleData(QByteArray packet, QHostAddress sender, quint16 senderPort);
-    void handleAcknowledgment(QByteArray packet, QHostAddress sender, quint16 senderPort);
-    void handleError(QByteArray packet, QHostAddress sender, quint16 senderPort);
+    int sendRequest(OpCode opCode, const QString &file, TransferType type, bool withOptions);
+    bool wantsOptions() const;
+    void processTftpPacket(const char *packet, int size, const QHostAddress &sender, quint16 senderPort);
+    void writeDatagram(QTftpPacketBuffer *packet, const QHostAddress &host, quint16 port);
+    void startUpload(const QHostAddress &host, quint16 port, qint64 firstBlock = 1);
+    void acknowledgeWindow(quint16 block);
+    bool isSpuriousDuplicate() const;
+    void fillWindow();
+    QTftpPacketBuffer *readSourceBlock();
+    bool sourceAtEnd() const;
+    void sendWindow();
+    void sendPending();
+    void armRetransmitTimer();
+    void sampleProbe();
+    void arm();
+    void probeArmed();
+    void addRttSample(qint64 rtt);
+    void resetStatistics();
+    void sendDatagram(const char *data, int size, const QHostAddress &host, quint16 port);
+    void reportProgress(qint64 done, qint64 total, bool force = false);
+    void reportUploadProgress(bool force = false);
+    void prepareSink();
+    void writeSink(const char *data, int size);
+    void writeSinkAt(qint64 offset, const char *data, int size);
+    void finishSink(bool error);
+    void sendAcknowledgment(quint16 block, const QHostAddress &host, quint16 port);
+    quint16 wireBlock(qint64 block) const {
+        return QTftpPacket::wireBlock(block, m_blockWrap);
+    }
+    qint64 blockFromWire(quint16 block, qint64 reference) const {
+        return QTftpPacket::blockFromWire(block, reference, m_blockWrap);
+    }
+    void acknowledgeDuplicate(quint16 block, const QHostAddress &sender, quint16 senderPort);
+    void sendErrorPacket(TFtpErrorCode code, const QString &message, const QHostAddress &host, quint16 port);
+    void handleOptionAcknowledgment(const char *packet, int size, const QHostAddress &sender, quint16 senderPort);
+    void handleData(const char *packet, int size, const QHostAddress &sender, quint16 senderPort);
+    void handleAcknowledgment(const char *packet, int size, const QHostAddress &sender, quint16 senderPort);
+    void handleError(const char *packet, int size, const QHostAddress &sender, quint16 senderPort);
+    void readDatagrams(QTftpBatchIO *io);
+    static bool parseMulticastOption(const QByteArray &value, QHostAddress *group, quint16 *port, bool *master);
+    bool joinMulticastGroup(const QHostAddress &group, quint16 port);
+    void leaveMulticastGroup();
+    void handleMulticastData(const char *data, int size, quint16 block);
+    void handleMulticastOptionAcknowledgment(const char *packet, int size, const QHostAddress &sender, quint16 senderPort);
+    struct MulticastClient {
+        QHostAddress address;
+        quint16 port;
+        quint16 windowSize;
+        QByteArray options;
+    };
+    void sendMulticastOptionAck(const MulticastClient &client, bool master);
+    void promoteMulticastClient();
+    void finishMulticastClient(bool error);
+    void handleMulticastAcknowledgment(quint16 block, const QHostAddress &sender, quint16 senderPort);
 
 private:
     /*
-     * We sometimes need to resent packages, but always just the most recent one
-     * so we simply store that
+     * Requests and ACKs are resent one at a time, so we simply store the most
+     * recent one. DATA blocks that are still unacknowledged are kept in the
+     * m_window ring, m_windowCount entries from m_windowHead on, the first one
+     * being block m_windowFirstBlock. All packets are taken from m_pool.
      */
-    char *m_currentPacket;
+    QTftpPacketPool m_pool;
+    QTftpPacketBuffer *m_currentPacket;
+    /* packet is NULL if the payload is sent straight out of m_sourceImage */
+    struct WindowEntry {
+        QTftpPacketBuffer *packet;
+        /* DATA header of a mapped block, it has to live until the batch is flushed */
+        char header[TFTP_HEADER_SIZE];
+        const char *payload;
+        int payloadSize;
+        qint64 block;
+        qint64 sentAt;
+        bool retransmitted;
+    };
+    WindowEntry &windowEntry(int index);
+    const WindowEntry &windowEntry(int index) const;
+    void sendWindowEntry(const WindowEntry &entry);
+    QVector<WindowEntry> m_window;
+    int m_windowHead;
+    int m_windowCount;
+    /* Entries of the window that went out, the rest waits for m_paceTimer */
+    int m_windowSent;
+    qint64 m_windowFirstBlock;
+    bool m_sourceFinished;
+    /*
+     * A window has been resent because of a duplicate or partial ACK. Only
+     * cleared by a duplicate ACK of a fresh window, the one after that may
+     * trigger the next fast retransmit.
+     */
+    bool m_fastRetransmitted;
+    /* The last new ACK answered a resent block, its duplicates may answer the copy */
+    bool m_ackedRetransmitted;
+    /* Receive side: blocks since our last ACK and whether a gap was reported */
+    quint16 m_blocksSinceAck;
+    bool m_gapAcked;
+    /* When a duplicate block was last answered, -1 if not during this transfer */
+    qint64 m_duplicateAckedAt;
     int  m_resentCount;
-    QTimer *m_resentTimer;
+    /* Armed mode, m_armedSince is -1 unless a WRQ waits for its first answer */
+    int m_armedInterval;
+    int m_armedTimeout;
+    qint64 m_armedSince;
+    /*
+     * Multicast client: the group socket and the server's TID, which sends
+     * the group DATA. Received blocks are marked in m_multicastReceived (bit
+     * block-1), m_multicastLastBlock is -1 as long as the size is unknown.
+     */
+    bool m_multicastRequested;
+    bool m_multicastSent;
+    QNetworkInterface m_multicastInterface;
+    QUdpSocket *m_multicastSocket;
+    QTftpBatchIO m_multicastIO;
+    QHostAddress m_multicastSender;
+    quint16 m_multicastSenderPort;
+    bool m_multicastMaster;
+    QBitArray m_multicastReceived;
+    int m_multicastFirstMissing;
+    int m_multicastLastBlock;
+    /* Multicast server: the first client is the master */
+    bool m_multicastServer;
+    QHostAddress m_multicastGroup;
+    quint16 m_multicastPort;
+    QList<MulticastClient> m_multicastClients;
+    QTftpStatistics m_statistics;
+    qint64 m_stateSince;
+    QTftpProgressMeter m_meter;
+    int  m_maxRetries;
+    /* On the wheel of the thread, as there may be thousands of sessions */
+    QTftpWheelTimer *m_resentTimer;
+    QTimer *m_paceTimer;
+    QTftpPacer m_pacer;
+    /*
+     * Timing of the packet in m_currentPacket, -1 once it has been resent.
+     * Used to measure the RTT of requests and ACKs.
+     */
+    QElapsedTimer m_clock;
+    qint64 m_probeSentAt;
+    QTftpRttEstimator m_rtt;
+    /*
+     * Upload source if put() was given an image instead of a QIODevice. DATA
+     * packets are then written straight from a header and the mapped payload.
+     */
+    QTftpImage m_sourceImage;
+    qint64 m_sourceOffset;
+    /*
+     * Upload source is a sequential device. It is read ahead no further
+     * than the window, m_streamPacket holds a block that is still partial.
+     */
+    bool m_streaming;
+    bool m_streamEnded;
+    QTftpPacketBuffer *m_streamPacket;
+    bool m_sourceHashing;
+    QCryptographicHash m_sourceHash;
     QHostAddress m_currentTarget;
     quint16 m_currentPort;
-    quint16 m_currentSize;
+    /* Sender of the datagram being handled */
+    QHostAddress m_rxSender;
+    quint16 m_rxSenderPort;
 
     QUdpSocket *m_udpSocket;
+    /* Sends a window with one system call and reads what has queued up in batches */
+    QTftpBatchIO m_udpIO;
     State m_State;
 
     Command m_CurrentCommand;
@@ -179,7 +522,32 @@ private:
     QHostAddress m_host;
     quint16 m_port;
 
-    quint16 m_BlockCount;
+    /* Next block to send or receive, the wire number is wireBlock() of it */
+    qint64 m_BlockCount;
+    quint16 m_blockWrap;
+    /*
+     * m_requestedBlockSize is what we ask for, m_blockSize what the peer agreed on.
+     * The request parameters are kept to repeat the request without options.
+     */
+    quint16 m_requestedBlockSize;
+    quint16 m_blockSize;
+    quint16 m_requestedWindowSize;
+    quint16 m_windowSize;
+    int m_requestedTimeout;
+    int m_timeout;
+    bool m_optionsSent;
+    /*
+     * Download sink: bytes written so far and the size announced by the peer.
+     * m_sinkFile is set if a QFile has been resized to that size, m_sinkMap
+     * if it is mapped as well.
+     */
+    qint64 m_transferSize;
+    qint64 m_transferred;
+    bool m_mappedDownloads;
+    QFile *m_sinkFile;
+    uchar *m_sinkMap;
+    QString m_requestFile;
+    TransferType m_requestType;
     QTftp::ErrorCode m_LastError;
     QString m_LastErrorMessage;
 };
@@ -0,0 +1,42 @@
+# TFTP engine shared by the GUI and the command line tool
+
+QT += network
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += $$PWD/qtftp.cpp \
+    $$PWD/qtftprttestimator.cpp \
+    $$PWD/qtftpsessionmanager.cpp \
+    $$PWD/qtftppacketpool.cpp \
+    $$PWD/qtftpimage.cpp \
+    $$PWD/qtftpserver.cpp \
+    $$PWD/qtftpthread.cpp \
+    $$PWD/qtftpprogress.cpp \
+    $$PWD/qtftpstatistics.cpp \
+    $$PWD/qtftplogging.cpp \
+    $$PWD/qtftpbatchio.cpp \
+    $$PWD/qtftppacket.cpp \
+    $$PWD/qtftphashsink.cpp \
+    $$PWD/qtftpdeviceprofile.cpp \
+    $$PWD/qtftppacer.cpp \
+    $$PWD/qtftptimerwheel.cpp \
+    $$PWD/qtftppipereader.cpp
+
+HEADERS += $$PWD/qtftp.h \
+    $$PWD/qtftprttestimator.h \
+    $$PWD/qtftpsessionmanager.h \
+    $$PWD/qtftppacketpool.h \
+    $$PWD/qtftpimage.h \
+    $$PWD/qtftpserver.h \
+    $$PWD/qtftpthread.h \
+    $$PWD/qtftpprogress.h \
+    $$PWD/qtftpstatistics.h \
+    $$PWD/qtftplogging.h \
+    $$PWD/qtftpbatchio.h \
+    $$PWD/qtftppacket.h \
+    $$PWD/qtftphashsink.h \
+    $$PWD/qtftpdeviceprofile.h \
+    $$PWD/qtftppacer.h \
+    $$PWD/qtftptimerwheel.h \
+    $$PWD/qtftppipereader.h
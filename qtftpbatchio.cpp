@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftpbatchio.h"
+#include "qtftppacketpool.h"
+#include <string.h>
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#endif
+
+QTftpBatchIO::QTftpBatchIO() :
+    m_socket(NULL),
+    m_datagramSize(TFTP_SMALL_PACKET_SIZE),
+    m_wantedSize(TFTP_SMALL_PACKET_SIZE),
+    m_slotCount(0),
+    m_received(0),
+    m_next(0),
+    m_lastSenderPort(0),
+    m_targetPort(0),
+    m_native(true)
+{
+    m_outgoing.reserve(TFTP_BATCH_SIZE);
+}
+
+QTftpBatchIO::~QTftpBatchIO()
+{
+}
+
+void QTftpBatchIO::setSocket(QUdpSocket *socket)
+{
+    /* The buffers are kept, a handler may still look at the datagram it has been given */
+    m_socket = socket;
+    m_received = 0;
+    m_next = 0;
+    m_lastSender.clear();
+    m_outgoing.clear();
+    m_target.clear();
+    m_targetAddress.clear();
+    m_targetPort = 0;
+    m_native = true;
+}
+
+void QTftpBatchIO::setDatagramSize(int size)
+{
+    /* Applied by the next batch, the slots of the current one may still be handed out */
+    m_wantedSize = qMax(m_wantedSize, size);
+}
+
+int QTftpBatchIO::readDatagram(const char **data, QHostAddress *sender, quint16 *port)
+{
+    if (m_socket == NULL)
+        return -1;
+    for (;;) {
+        while (m_next < m_received) {
+            const int slot = m_next++;
+            if (m_sizes.at(slot) < 0)
+                continue;
+            *data = m_slots.constData() + slot * m_datagramSize;
+            senderAddress(slot, sender, port);
+            return m_sizes.at(slot);
+        }
+        /* A batch that was not full has drained the socket */
+        if (m_received == 0 || m_received < m_slotCount)
+            break;
+        receiveBatch();
+    }
+    m_received = 0;
+    m_next = 0;
+
+    /*
+     * QUdpSocket stops watching the socket until readDatagram() is called on
+     * it, so the first datagram always goes through it. Everything queued
+     * behind it is then fetched in batches.
+     */
+    if (!m_socket->hasPendingDatagrams())
+        return -1;
+    int size = m_socket->pendingDatagramSize();
+    if (m_first.size() < qMax(size, m_wantedSize))
+        m_first.resize(qMax(size, m_wantedSize));
+    size = m_socket->readDatagram(m_first.data(), m_first.size(), sender, port);
+    if (size < 0)
+        return -1;
+    *data = m_first.constData();
+    receiveBatch();
+    return size;
+}
+
+void QTftpBatchIO::receiveBatch()
+{
+    m_received = 0;
+    m_next = 0;
+#ifdef Q_OS_LINUX
+    if (m_slotCount == 0 || m_wantedSize != m_datagramSize) {
+        m_datagramSize = m_wantedSize;
+        m_slotCount = qBound(1, TFTP_BATCH_BYTES / m_datagramSize, TFTP_BATCH_SIZE);
+        m_slots.resize(m_slotCount * m_datagramSize);
+        m_senders.resize(m_slotCount * sizeof(struct sockaddr_storage));
+        m_sizes.resize(m_slotCount);
+        m_senderSizes.resize(m_slotCount);
+    }
+    struct mmsghdr messages[TFTP_BATCH_SIZE];
+    struct iovec iov[TFTP_BATCH_SIZE];
+    memset(messages, 0, m_slotCount * sizeof(struct mmsghdr));
+    char *buffers = m_slots.data();
+    char *senders = m_senders.data();
+    for (int i = 0; i < m_slotCount; i++) {
+        iov[i].iov_base = buffers + i * m_datagramSize;
+        iov[i].iov_len = m_datagramSize;
+        messages[i].msg_hdr.msg_name = senders + i * sizeof(struct sockaddr_storage);
+        messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int count;
+    do {
+        count = ::recvmmsg(m_socket->socketDescriptor(), messages, m_slotCount, MSG_DONTWAIT, NULL);
+    } while (count < 0 && errno == EINTR);
+    if (count <= 0)
+        return;
+    for (int i = 0; i < count; i++) {
+        /* Larger than anything negotiated, it can't be a packet of ours */
+        m_sizes[i] = messages[i].msg_hdr.msg_flags & MSG_TRUNC ? -1 : (int) messages[i].msg_len;
+        m_senderSizes[i] = messages[i].msg_hdr.msg_namelen;
+    }
+    m_received = count;
+#endif
+}
+
+void QTftpBatchIO::senderAddress(int slot, QHostAddress *sender, quint16 *port)
+{
+#ifdef Q_OS_UNIX
+    const char *name = m_senders.constData() + slot * sizeof(struct sockaddr_storage);
+    const int nameSize = m_senderSizes.at(slot);
+    /* A window of ACKs or a burst of requests mostly comes from one peer */
+    if (m_lastSender.size() != nameSize || memcmp(m_lastSender.constData(), name, nameSize) != 0) {
+        m_lastSender = QByteArray(name, nameSize);
+        const struct sockaddr *addr = (const struct sockaddr *) name;
+        if (addr->sa_family == AF_INET) {
+            const struct sockaddr_in *in = (const struct sockaddr_in *) name;
+            m_lastSenderAddress.setAddress(ntohl(in->sin_addr.s_addr));
+            m_lastSenderPort = ntohs(in->sin_port);
+        } else if (addr->sa_family == AF_INET6) {
+            const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) name;
+            Q_IPV6ADDR address;
+            memcpy(&address, in6->sin6_addr.s6_addr, sizeof(address));
+            m_lastSenderAddress.setAddress(address);
+            if (in6->sin6_scope_id != 0)
+                m_lastSenderAddress.setScopeId(QString::number(in6->sin6_scope_id));
+            m_lastSenderPort = ntohs(in6->sin6_port);
+        } else {
+            m_lastSenderAddress.clear();
+            m_lastSenderPort = 0;
+        }
+    }
+#else
+    Q_UNUSED(slot);
+#endif
+    if (sender != NULL)
+        *sender = m_lastSenderAddress;
+    if (port != NULL)
+        *port = m_lastSenderPort;
+}
+
+void QTftpBatchIO::queueDatagram(const char *header, int headerSize, const char *payload, int payloadSize,
+                                 const QHostAddress &host, quint16 port)
+{
+    if (m_socket == NULL)
+        return;
+    Outgoing datagram;
+    datagram.header = header;
+    datagram.headerSize = headerSize;
+    datagram.payload = payload;
+    datagram.payloadSize = payloadSize;
+    /* A batch has a single target */
+    if (!m_outgoing.isEmpty() && (port != m_targetPort || host != m_targetAddress))
+        flush();
+    if (m_native && updateTarget(host, port)) {
+        m_outgoing.append(datagram);
+        if (m_outgoing.size() >= TFTP_BATCH_SIZE)
+            flush();
+        return;
+    }
+    writeCopy(datagram, host, port);
+}
+
+void QTftpBatchIO::flush()
+{
+    if (m_outgoing.isEmpty())
+        return;
+    int sent = 0;
+#ifdef Q_OS_UNIX
+    const int count = m_outgoing.size();
+    struct iovec iov[2*TFTP_BATCH_SIZE];
+#ifdef Q_OS_LINUX
+    struct mmsghdr messages[TFTP_BATCH_SIZE];
+    memset(messages, 0, count * sizeof(struct mmsghdr));
+#else
+    struct msghdr messages[TFTP_BATCH_SIZE];
+    memset(messages, 0, count * sizeof(struct msghdr));
+#endif
+    for (int i = 0; i < count; i++) {
+        const Outgoing &datagram = m_outgoing.at(i);
+        iov[2*i].iov_base = (void *) datagram.header;
+        iov[2*i].iov_len = datagram.headerSize;
+        iov[2*i+1].iov_base = (void *) datagram.payload;
+        iov[2*i+1].iov_len = datagram.payloadSize;
+#ifdef Q_OS_LINUX
+        struct msghdr &msg = messages[i].msg_hdr;
+#else
+        struct msghdr &msg = messages[i];
+#endif
+        msg.msg_name = (void *) m_target.constData();
+        msg.msg_namelen = m_target.size();
+        msg.msg_iov = &iov[2*i];
+        msg.msg_iovlen = datagram.payloadSize > 0 ? 2 : 1;
+    }
+    const int fd = m_socket->socketDescriptor();
+    while (sent < count) {
+#ifdef Q_OS_LINUX
+        int result = ::sendmmsg(fd, messages + sent, count - sent, 0);
+#else
+        int result = ::sendmsg(fd, messages + sent, 0) < 0 ? -1 : 1;
+#endif
+        if (result > 0) {
+            sent += result;
+            continue;
+        }
+        if (result < 0 && errno == EINTR)
+            continue;
+        /* A full send buffer just loses the rest, the retransmission takes care of it */
+        if (result == 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+            sent = count;
+        else
+            m_native = false;
+        break;
+    }
+#endif
+    /* The socket does not take native writes, it never will */
+    for (int i = sent; i < m_outgoing.size(); i++)
+        writeCopy(m_outgoing.at(i), m_targetAddress, m_targetPort);
+    m_outgoing.clear();
+}
+
+void QTftpBatchIO::writeCopy(const Outgoing &datagram, const QHostAddress &host, quint16 port)
+{
+    const int size = datagram.headerSize + datagram.payloadSize;
+    if (m_copy.size() < size)
+        m_copy.resize(size);
+    memcpy(m_copy.data(), datagram.header, datagram.headerSize);
+    if (datagram.payloadSize > 0)
+        memcpy(m_copy.data() + datagram.headerSize, datagram.payload, datagram.payloadSize);
+    m_socket->writeDatagram(m_copy.constData(), size, host, port);
+}
+
+bool QTftpBatchIO::updateTarget(const QHostAddress &host, quint16 port)
+{
+    if (port == m_targetPort && host == m_targetAddress)
+        return !m_target.isEmpty();
+    m_target.clear();
+    m_targetAddress = host;
+    m_targetPort = port;
+#ifdef Q_OS_UNIX
+    /* The address has to match the family the socket has been bound with */
+    struct sockaddr_storage local;
+    socklen_t localSize = sizeof(local);
+    if (::getsockname(m_socket->socketDescriptor(), (struct sockaddr *) &local, &localSize) < 0)
+        return false;
+    bool ipv4 = host.protocol() == QAbstractSocket::IPv4Protocol;
+    if (local.ss_family == AF_INET && ipv4) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(host.toIPv4Address());
+        m_target = QByteArray((const char *) &addr, sizeof(addr));
+    } else if (local.ss_family == AF_INET6 && (ipv4 || host.scopeId().isEmpty())) {
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_port = htons(port);
+        if (ipv4) {
+            /* IPv4-mapped IPv6 address, ::ffff:a.b.c.d */
+            quint32 ipv4Address = htonl(host.toIPv4Address());
+            addr.sin6_addr.s6_addr[10] = 0xff;
+            addr.sin6_addr.s6_addr[11] = 0xff;
+            memcpy(&addr.sin6_addr.s6_addr[12], &ipv4Address, 4);
+        } else {
+            Q_IPV6ADDR ipv6Address = host.toIPv6Address();
+            memcpy(addr.sin6_addr.s6_addr, &ipv6Address, 16);
+        }
+        m_target = QByteArray((const char *) &addr, sizeof(addr));
+    }
+#endif
+    return !m_target.isEmpty();
+}
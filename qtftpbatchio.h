@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Batched datagram I/O on top of a QUdpSocket. On Linux a window of DATA
+ * packets leaves with a single sendmmsg() and whatever else is queued on
+ * the socket is picked up with a single recvmmsg(), both into buffers that
+ * are allocated once. The QUdpSocket still binds, joins groups and reads
+ * the datagram that woke us up, and it is all that is used elsewhere.
+ *
+ */
+
+#ifndef QTFTPBATCHIO_H
+#define QTFTPBATCHIO_H
+#include <QByteArray>
+#include <QHostAddress>
+#include <QUdpSocket>
+#include <QVector>
+
+/* Datagrams moved by one recvmmsg() or sendmmsg() at most */
+#define TFTP_BATCH_SIZE 32
+/* Receive buffers of a batch, the number of slots shrinks with the datagram size */
+#define TFTP_BATCH_BYTES 65536
+
+class QTftpBatchIO
+{
+public:
+    QTftpBatchIO();
+    ~QTftpBatchIO();
+
+    /* Detaches from the previous socket, dropping what has been received or queued */
+    void setSocket(QUdpSocket *socket);
+    QUdpSocket *socket() const {
+        return m_socket;
+    }
+    /* Largest datagram expected, longer ones are dropped unless the socket reads them */
+    void setDatagramSize(int size);
+    int datagramSize() const {
+        return m_wantedSize;
+    }
+
+    /*
+     * Returns the next received datagram, or -1 once the socket has been
+     * drained. data points into a buffer that is reused by the next call.
+     */
+    int readDatagram(const char **data, QHostAddress *sender, quint16 *port);
+
+    /*
+     * Queues a datagram made of header and payload, neither is copied and
+     * both have to stay valid until flush(). A full batch is sent right away.
+     */
+    void queueDatagram(const char *header, int headerSize, const char *payload, int payloadSize,
+                       const QHostAddress &host, quint16 port);
+    void flush();
+
+private:
+    Q_DISABLE_COPY(QTftpBatchIO)
+
+    struct Outgoing {
+        const char *header;
+        int headerSize;
+        const char *payload;
+        int payloadSize;
+    };
+
+    void receiveBatch();
+    void senderAddress(int slot, QHostAddress *sender, quint16 *port);
+    void writeCopy(const Outgoing &datagram, const QHostAddress &host, quint16 port);
+    bool updateTarget(const QHostAddress &host, quint16 port);
+
+    QUdpSocket *m_socket;
+    int m_datagramSize;
+    int m_wantedSize;
+
+    /* Datagram read by QUdpSocket, which re-enables its read notifier */
+    QByteArray m_first;
+    /* recvmmsg() slots of m_datagramSize bytes and their senders, a size of -1 marks a truncated datagram */
+    QByteArray m_slots;
+    QByteArray m_senders;
+    QVector<int> m_sizes;
+    QVector<int> m_senderSizes;
+    int m_slotCount;
+    int m_received;
+    int m_next;
+    /* The last sender converted into a QHostAddress */
+    QByteArray m_lastSender;
+    QHostAddress m_lastSenderAddress;
+    quint16 m_lastSenderPort;
+
+    QVector<Outgoing> m_outgoing;
+    /* sockaddr of m_targetAddress:m_targetPort for the socket's address family */
+    QByteArray m_target;
+    QHostAddress m_targetAddress;
+    quint16 m_targetPort;
+    bool m_native;
+    QByteArray m_copy;
+};
+
+#endif // QTFTPBATCHIO_H
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftpdeviceprofile.h"
+#include <QSettings>
+
+static QString profileGroup(const QString &host)
+{
+    /* A slash would nest groups */
+    QString key = host.toLower();
+    key.replace("/", "_");
+    return "deviceProfiles/" + key;
+}
+
+QTftpDeviceProfile::QTftpDeviceProfile() :
+    acceptsOptions(false),
+    blockSize(TFTP_DEFAULT_BLOCKSIZE),
+    windowSize(TFTP_DEFAULT_WINDOWSIZE),
+    smoothedRtt(-1),
+    retransmitTimeout(TFTP_INITIAL_RTO),
+    lossRate(0),
+    pacingBurst(0),
+    pacingGap(0),
+    transfers(0)
+{
+}
+
+QTftpDeviceProfile QTftpDeviceProfile::load(const QString &host)
+{
+    QTftpDeviceProfile profile;
+    if (host.isEmpty())
+        return profile;
+    QSettings settings;
+    settings.beginGroup(profileGroup(host));
+    profile.acceptsOptions = settings.value("acceptsOptions", false).toBool();
+    profile.blockSize = qBound<uint>(TFTP_MIN_BLOCKSIZE, settings.value("blockSize", TFTP_DEFAULT_BLOCKSIZE).toUInt(),
+                                     TFTP_MAX_BLOCKSIZE);
+    profile.windowSize = qBound<uint>(TFTP_DEFAULT_WINDOWSIZE, settings.value("windowSize", TFTP_DEFAULT_WINDOWSIZE).toUInt(),
+                                      0xffff);
+    profile.smoothedRtt = settings.value("smoothedRtt", -1).toInt();
+    profile.retransmitTimeout = settings.value("retransmitTimeout", TFTP_INITIAL_RTO).toInt();
+    profile.lossRate = settings.value("lossRate", 0).toDouble();
+    profile.pacingBurst = settings.value("pacingBurst", 0).toInt();
+    profile.pacingGap = settings.value("pacingGap", 0).toInt();
+    profile.transfers = settings.value("transfers", 0).toInt();
+    settings.endGroup();
+    return profile;
+}
+
+void QTftpDeviceProfile::forget(const QString &host)
+{
+    if (host.isEmpty())
+        return;
+    QSettings settings;
+    settings.remove(profileGroup(host));
+}
+
+void QTftpDeviceProfile::save(const QString &host) const
+{
+    if (host.isEmpty())
+        return;
+    QSettings settings;
+    settings.beginGroup(profileGroup(host));
+    settings.setValue("acceptsOptions", acceptsOptions);
+    settings.setValue("blockSize", blockSize);
+    settings.setValue("windowSize", windowSize);
+    settings.setValue("smoothedRtt", smoothedRtt);
+    settings.setValue("retransmitTimeout", retransmitTimeout);
+    settings.setValue("lossRate", lossRate);
+    settings.setValue("pacingBurst", pacingBurst);
+    settings.setValue("pacingGap", pacingGap);
+    settings.setValue("transfers", transfers);
+    settings.endGroup();
+}
+
+QTftpDeviceProfile QTftpDeviceProfile::learn(QTftp *tftp) const
+{
+    QTftpDeviceProfile profile = *this;
+    const QTftpStatistics statistics = tftp->statistics();
+    /* Anything negotiated means the device answered with an OACK */
+    profile.acceptsOptions = tftp->blockSize() != TFTP_DEFAULT_BLOCKSIZE || tftp->windowSize() != TFTP_DEFAULT_WINDOWSIZE
+            || tftp->timeoutInterval() != 0;
+    profile.blockSize = tftp->blockSize();
+    const qint64 sent = qMax<qint64>(1, statistics.packetsSent - statistics.retransmissions);
+    profile.lossRate = (double) statistics.retransmissions / sent;
+    /* Multiplicative decrease after a lossy transfer, probe for more after a clean one */
+    quint16 window = tftp->windowSize();
+    if (profile.lossRate > TFTP_PROFILE_MAX_LOSS)
+        window = qMax<quint16>(TFTP_DEFAULT_WINDOWSIZE, window / 2);
+    else if (profile.lossRate < TFTP_PROFILE_MIN_LOSS)
+        window = qMin<int>(0xffff, 2 * window);
+    profile.windowSize = window;
+    if (tftp->smoothedRtt() >= 0) {
+        profile.smoothedRtt = tftp->smoothedRtt();
+        profile.retransmitTimeout = tftp->retransmitTimeout();
+    }
+    /* Fixed pacing is the user's choice, nothing learned about the device */
+    if (tftp->pacingAutoTune()) {
+        profile.pacingBurst = tftp->pacingBurst();
+        profile.pacingGap = tftp->pacingGap();
+    }
+    profile.transfers++;
+    return profile;
+}
+
+void QTftpDeviceProfile::apply(QTftp *tftp) const
+{
+    if (!isValid())
+        return;
+    if (acceptsOptions) {
+        tftp->setBlockSize(qMin(blockSize, tftp->requestedBlockSize()));
+        tftp->setWindowSize(qMin(windowSize, tftp->requestedWindowSize()));
+    } else {
+        /* It ignores them anyway, so plain RFC 1350 from the start */
+        tftp->setBlockSize(TFTP_DEFAULT_BLOCKSIZE);
+        tftp->setWindowSize(TFTP_DEFAULT_WINDOWSIZE);
+    }
+    tftp->setInitialRetransmitTimeout(retransmitTimeout);
+    if (tftp->pacingAutoTune())
+        tftp->setPacing(pacingBurst, pacingGap, true);
+}
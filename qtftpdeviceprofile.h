@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * QTftpDeviceProfile remembers in QSettings what worked for a device the
+ * last time: whether it accepted options, the negotiated block size, the
+ * window that is worth asking for, the RTT and retransmission timeout and
+ * the loss rate, and where auto-tuned pacing settled. Applied to a QTftp,
+ * a known device starts at full speed instead of with the conservative
+ * defaults. A transfer that fails with a profile should forget it and be
+ * repeated without.
+ *
+ */
+
+#ifndef QTFTPDEVICEPROFILE_H
+#define QTFTPDEVICEPROFILE_H
+#include <QString>
+#include "qtftp.h"
+
+/* A window with more retransmissions per DATA packet than this is halved */
+#define TFTP_PROFILE_MAX_LOSS 0.05
+/* Below this the window is doubled, never beyond what the QTftp requests */
+#define TFTP_PROFILE_MIN_LOSS 0.01
+
+struct QTftpDeviceProfile {
+    QTftpDeviceProfile();
+    /* There is something to apply once a transfer succeeded */
+    bool isValid() const {
+        return transfers > 0;
+    }
+
+    /* Stored by host name or address, as given to QTftp::connectToHost() */
+    static QTftpDeviceProfile load(const QString &host);
+    static void forget(const QString &host);
+    void save(const QString &host) const;
+
+    /* This profile updated with the last transfer of tftp, which has to have succeeded */
+    QTftpDeviceProfile learn(QTftp *tftp) const;
+    /* Starting parameters for the next transfer, never beyond the requested ones */
+    void apply(QTftp *tftp) const;
+
+    bool acceptsOptions;
+    quint16 blockSize;
+    quint16 windowSize;
+    /* In ms, -1 if unknown */
+    int smoothedRtt;
+    int retransmitTimeout;
+    /* Retransmissions per DATA packet of the last transfer */
+    double lossRate;
+    /* Auto-tuned pacing of the last transfer, see QTftp::setPacing() */
+    int pacingBurst;
+    int pacingGap;
+    int transfers;
+};
+
+#endif // QTFTPDEVICEPROFILE_H
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftphashsink.h"
+#include <limits.h>
+
+QTftpHashSink::QTftpHashSink(QCryptographicHash::Algorithm algorithm, QObject *parent) :
+    QIODevice(parent),
+    m_hash(algorithm),
+    m_bytes(0)
+{
+}
+
+bool QTftpHashSink::open(QIODevice::OpenMode mode)
+{
+    if ((mode & ReadOnly) != 0)
+        return false;
+    m_hash.reset();
+    m_bytes = 0;
+    return QIODevice::open(mode);
+}
+
+qint64 QTftpHashSink::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+qint64 QTftpHashSink::writeData(const char *data, qint64 size)
+{
+    /* addData() takes an int */
+    for (qint64 offset = 0; offset < size; offset += INT_MAX)
+        m_hash.addData(data + offset, (int) qMin<qint64>(size - offset, INT_MAX));
+    m_bytes += size;
+    return size;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * QTftpHashSink is a write-only device that hashes whatever is written to
+ * it and keeps nothing else. Handed to QTftp::get() it checks a file on the
+ * device block by block as it arrives, however large the file is.
+ *
+ */
+
+#ifndef QTFTPHASHSINK_H
+#define QTFTPHASHSINK_H
+#include <QIODevice>
+#include <QCryptographicHash>
+
+/* Used to compare an image with what a device sends back */
+#define TFTP_VERIFY_HASH QCryptographicHash::Sha1
+
+class QTftpHashSink : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit QTftpHashSink(QCryptographicHash::Algorithm algorithm = TFTP_VERIFY_HASH, QObject *parent = 0);
+
+    /* Opening starts a new hash, only WriteOnly is supported */
+    bool open(OpenMode mode);
+    bool isSequential() const {
+        return true;
+    }
+    /* Hash and number of the bytes written since open() */
+    QByteArray result() const {
+        return m_hash.result();
+    }
+    qint64 bytesHashed() const {
+        return m_bytes;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 size);
+
+private:
+    QCryptographicHash m_hash;
+    qint64 m_bytes;
+};
+
+#endif // QTFTPHASHSINK_H
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftpimage.h"
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWeakPointer>
+
+class QTftpImagePrivate
+{
+public:
+    QTftpImagePrivate() :
+        data(NULL),
+        size(0)
+    {
+    }
+    ~QTftpImagePrivate()
+    {
+        /* Closing the file also removes the mapping */
+        file.close();
+    }
+
+    QFile file;
+    /* To notice that a mapped file has been replaced */
+    QDateTime modified;
+    /* Only used for images held in memory */
+    QByteArray bytes;
+    const char *data;
+    qint64 size;
+};
+
+/*
+ * All mappings that are still in use, by canonical file name. Entries of
+ * released mappings are pruned when a file is mapped, not when the last
+ * image goes away: that may happen in map() itself, with the mutex held.
+ */
+typedef QHash<QString, QWeakPointer<QTftpImagePrivate> > QTftpImageRegistry;
+static QMutex registryMutex;
+static QTftpImageRegistry registry;
+
+QTftpImage::QTftpImage()
+{
+}
+
+QTftpImage::QTftpImage(const QByteArray &data) :
+    d(new QTftpImagePrivate)
+{
+    d->bytes = data;
+    d->data = d->bytes.constData();
+    d->size = d->bytes.size();
+}
+
+QTftpImage::QTftpImage(const QSharedPointer<QTftpImagePrivate> &dd) :
+    d(dd)
+{
+}
+
+QTftpImage QTftpImage::map(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    QString key = info.canonicalFilePath();
+    if (key.isEmpty())
+        return QTftpImage();
+
+    QMutexLocker locker(&registryMutex);
+    QSharedPointer<QTftpImagePrivate> dd = registry.value(key).toStrongRef();
+    if (!dd.isNull() && dd->modified == info.lastModified() && dd->size == info.size())
+        return QTftpImage(dd);
+
+    /* A stale mapping stays valid for whoever still uses it */
+    dd = QSharedPointer<QTftpImagePrivate>(new QTftpImagePrivate);
+    dd->file.setFileName(key);
+    if (!dd->file.open(QIODevice::ReadOnly))
+        return QTftpImage();
+    dd->modified = info.lastModified();
+    dd->size = dd->file.size();
+    /* An empty image is valid, there just is nothing to map */
+    if (dd->size > 0) {
+        dd->data = (const char *) dd->file.map(0, dd->size);
+        if (dd->data == NULL)
+            return QTftpImage();
+    }
+    /* A server maps ever new files, don't keep the names of released ones */
+    QTftpImageRegistry::iterator it = registry.begin();
+    while (it != registry.end()) {
+        if (it.value().isNull())
+            it = registry.erase(it);
+        else
+            ++it;
+    }
+    registry.insert(key, dd.toWeakRef());
+    return QTftpImage(dd);
+}
+
+const char *QTftpImage::data() const
+{
+    return d.isNull() ? NULL : d->data;
+}
+
+qint64 QTftpImage::size() const
+{
+    return d.isNull() ? 0 : d->size;
+}
+
+QString QTftpImage::fileName() const
+{
+    /* Empty for images held in memory */
+    return d.isNull() ? QString() : d->file.fileName();
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A read-only firmware image in memory. Images opened with map() are
+ * memory-mapped and shared: as long as one QTftpImage refers to a file,
+ * mapping it again returns the same mapping, so uploading one image to
+ * many devices reads the file only once. QTftp sends DATA blocks straight
+ * out of the image without copying the payload.
+ *
+ * A mapped file must not be rewritten in place while it is in use. A
+ * transfer then sends a mix of old and new data, or dies of SIGBUS once
+ * the file has been truncated. Replace an image by writing a new file
+ * and renaming it over the old one, like "objcopy ... fw.tmp && mv fw.tmp
+ * fw.bin". The old mapping stays valid for the transfers using it and the
+ * next map() picks up the new file.
+ *
+ * An image can also wrap a QByteArray, e.g. firmware personalized in memory.
+ * The QByteArray is implicitly shared, not copied, and kept alive by the image.
+ *
+ */
+
+#ifndef QTFTPIMAGE_H
+#define QTFTPIMAGE_H
+#include <QString>
+#include <QByteArray>
+#include <QSharedPointer>
+
+class QTftpImagePrivate;
+
+class QTftpImage
+{
+public:
+    QTftpImage();
+    explicit QTftpImage(const QByteArray &data);
+
+    /*
+     * Returns a null image if the file can't be opened or mapped. The file
+     * has to be replaced by rename(), not rewritten, while it is mapped.
+     */
+    static QTftpImage map(const QString &fileName);
+
+    bool isNull() const {
+        return d.isNull();
+    }
+    const char *data() const;
+    qint64 size() const;
+    QString fileName() const;
+
+private:
+    explicit QTftpImage(const QSharedPointer<QTftpImagePrivate> &dd);
+
+    QSharedPointer<QTftpImagePrivate> d;
+};
+
+#endif // QTFTPIMAGE_H
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Logging of the TFTP engine. "qtftp" carries events like failed binds or
+ * refused requests, "qtftp.packet" one line per datagram and is disabled by
+ * default. Turn it on with QT_LOGGING_RULES="qtftp.packet.debug=true".
+ * A disabled category costs a single check, the message isn't even built.
+ * Before Qt 5.4 a category can't be disabled by default, so the per packet
+ * lines are compiled out there.
+ *
+ */
+
+#ifndef QTFTPLOGGING_H
+#define QTFTPLOGGING_H
+#include <QtGlobal>
+#include <QDebug>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 2, 0)
+#include <QLoggingCategory>
+Q_DECLARE_LOGGING_CATEGORY(lcTftp)
+#define tftpDebug() qCDebug(lcTftp)
+#else
+#define tftpDebug() qDebug()
+#endif
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+Q_DECLARE_LOGGING_CATEGORY(lcTftpPacket)
+#define tftpPacketDebug() qCDebug(lcTftpPacket)
+#else
+#define tftpPacketDebug() while (false) qDebug()
+#endif
+
+#endif // QTFTPLOGGING_H
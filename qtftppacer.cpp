@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftppacer.h"
+
+QTftpPacer::QTftpPacer() :
+    m_configuredBurst(0),
+    m_configuredGap(0),
+    m_autoTune(false)
+{
+    reset();
+}
+
+void QTftpPacer::setPacing(int burst, int gap, bool autoTune)
+{
+    m_configuredBurst = qMax(0, burst);
+    m_configuredGap = qBound(0, gap, TFTP_MAX_PACING_GAP);
+    m_autoTune = autoTune;
+    reset();
+}
+
+void QTftpPacer::reset()
+{
+    m_burst = m_configuredBurst;
+    m_gap = m_configuredGap;
+    m_cleanWindows = 0;
+}
+
+int QTftpPacer::burst(int windowSize) const
+{
+    if (m_burst <= 0 || m_gap <= 0)
+        return windowSize;
+    return qMin(m_burst, windowSize);
+}
+
+void QTftpPacer::lossDetected(int windowSize)
+{
+    if (!m_autoTune)
+        return;
+    m_cleanWindows = 0;
+    const int current = burst(windowSize);
+    if (current > 1) {
+        m_burst = current / 2;
+        m_gap = qMax(m_gap, 1);
+    } else {
+        m_gap = qMin(TFTP_MAX_PACING_GAP, 2 * m_gap);
+    }
+}
+
+void QTftpPacer::windowAcknowledged(int windowSize)
+{
+    if (!m_autoTune || !isPacing(windowSize))
+        return;
+    if (++m_cleanWindows < TFTP_PACING_PROBE_WINDOWS)
+        return;
+    m_cleanWindows = 0;
+    if (m_gap > 1)
+        m_gap /= 2;
+    else
+        m_burst++;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Pacing of the DATA packets of a window, for devices with a small receive
+ * buffer like the ENC28J60 of many Ethersex boards: at most burst() packets
+ * leave back to back, then the sender is quiet for gap() ms. Auto-tuning
+ * works like congestion control (AIMD): a loss halves the burst down to a
+ * single packet and then doubles the gap, every few clean windows the gap
+ * is halved again and, once it is down to 1 ms, the burst grows by one
+ * packet until whole windows go out unpaced.
+ *
+ */
+
+#ifndef QTFTPPACER_H
+#define QTFTPPACER_H
+#include <QtGlobal>
+
+/* Longest gap auto-tuning backs off to, in ms */
+#define TFTP_MAX_PACING_GAP 64
+/* Clean windows in a row before auto-tuning probes for more */
+#define TFTP_PACING_PROBE_WINDOWS 4
+
+class QTftpPacer
+{
+public:
+    QTftpPacer();
+
+    /*
+     * A burst or gap of 0 doesn't pace. With autoTune, pacing starts from
+     * there and follows the losses of the transfer.
+     */
+    void setPacing(int burst, int gap, bool autoTune);
+    bool autoTune() const {
+        return m_autoTune;
+    }
+    /* Back to the configured values, for a new transfer */
+    void reset();
+
+    /* Packets of a window of windowSize that may leave back to back */
+    int burst(int windowSize) const;
+    int gap() const {
+        return m_gap;
+    }
+    bool isPacing(int windowSize) const {
+        return burst(windowSize) < windowSize;
+    }
+
+    /* A DATA packet had to be sent again */
+    void lossDetected(int windowSize);
+    /* A whole window was acknowledged without any retransmission */
+    void windowAcknowledged(int windowSize);
+
+private:
+    int m_configuredBurst;
+    int m_configuredGap;
+    bool m_autoTune;
+    int m_burst;
+    int m_gap;
+    int m_cleanWindows;
+};
+
+#endif // QTFTPPACER_H
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftppacket.h"
+#include <string.h>
+
+bool QTftpPacketString::equals(const char *other) const
+{
+    for (int i = 0; i < size; i++) {
+        char c = data[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        /* other ends early on its terminator */
+        if (c != other[i])
+            return false;
+    }
+    return other[size] == '\0';
+}
+
+bool QTftpPacketString::toNumber(quint64 maximum, quint64 *value) const
+{
+    if (size == 0 || size > 20)
+        return false;
+    quint64 number = 0;
+    for (int i = 0; i < size; i++) {
+        if (data[i] < '0' || data[i] > '9')
+            return false;
+        const quint64 digit = data[i] - '0';
+        if (digit > maximum || number > (maximum - digit) / 10)
+            return false;
+        number = number * 10 + digit;
+    }
+    *value = number;
+    return true;
+}
+
+quint16 QTftpPacket::wireBlock(qint64 block, quint16 wrap)
+{
+    /* Block 0 only ever answers the request, so wrapping to 1 leaves a shorter cycle */
+    if (wrap == 0 || block <= 0)
+        return (quint16) block;
+    return (quint16) ((block - 1) % 0xffff + 1);
+}
+
+qint64 QTftpPacket::blockFromWire(quint16 block, qint64 reference, quint16 wrap)
+{
+    if (wrap != 0 && block == 0)
+        return 0;
+    const qint64 cycle = wrap == 0 ? 0x10000 : 0xffff;
+    qint64 distance = ((qint64) block - wireBlock(reference, wrap)) % cycle;
+    if (distance < 0)
+        distance += cycle;
+    if (distance >= cycle / 2)
+        distance -= cycle;
+    return reference + distance;
+}
+
+int QTftpPacket::terminatedLength(const char *packet, int size, int offset)
+{
+    if (offset >= size)
+        return -1;
+    const char *end = (const char *) memchr(packet + offset, '\0', size - offset);
+    return end != NULL ? end - (packet + offset) : -1;
+}
+
+bool QTftpPacket::parseData(const char *packet, int size, quint16 *block, const char **payload, int *payloadSize)
+{
+    if (size < TFTP_HEADER_SIZE)
+        return false;
+    *block = read16(packet+2);
+    *payload = packet + TFTP_HEADER_SIZE;
+    *payloadSize = size - TFTP_HEADER_SIZE;
+    return true;
+}
+
+bool QTftpPacket::parseAcknowledgment(const char *packet, int size, quint16 *block)
+{
+    if (size < TFTP_HEADER_SIZE)
+        return false;
+    *block = read16(packet+2);
+    return true;
+}
+
+bool QTftpPacket::parseError(const char *packet, int size, quint16 *code, QTftpPacketString *message)
+{
+    if (size < TFTP_HEADER_SIZE)
+        return false;
+    *code = read16(packet+2);
+    message->data = packet + TFTP_HEADER_SIZE;
+    message->size = qstrnlen(message->data, size - TFTP_HEADER_SIZE);
+    return true;
+}
+
+bool QTftpPacket::parseRequest(const char *packet, int size, QTftpPacketString *file,
+                               QTftpPacketString *mode, int *options)
+{
+    int offset = 2;
+    const int fileLength = terminatedLength(packet, size, offset);
+    if (fileLength <= 0)
+        return false;
+    file->data = packet + offset;
+    file->size = fileLength;
+    offset += fileLength + 1;
+    const int modeLength = terminatedLength(packet, size, offset);
+    if (modeLength <= 0)
+        return false;
+    mode->data = packet + offset;
+    mode->size = modeLength;
+    *options = offset + modeLength + 1;
+    return true;
+}
+
+bool QTftpPacket::nextOption(const char *packet, int size, int *offset,
+                             QTftpPacketString *name, QTftpPacketString *value)
+{
+    const int nameLength = terminatedLength(packet, size, *offset);
+    if (nameLength <= 0)
+        return false;
+    /* A value may be empty, the multicast option of a request is (RFC 2090) */
+    const int valueLength = terminatedLength(packet, size, *offset + nameLength + 1);
+    if (valueLength < 0)
+        return false;
+    name->data = packet + *offset;
+    name->size = nameLength;
+    value->data = name->data + nameLength + 1;
+    value->size = valueLength;
+    *offset += nameLength + valueLength + 2;
+    return true;
+}
+
+int QTftpPacket::appendString(char *buffer, int capacity, int offset, const char *string, int size)
+{
+    if (offset < 0 || size + 1 > capacity - offset)
+        return -1;
+    memcpy(buffer + offset, string, size);
+    buffer[offset + size] = '\0';
+    return offset + size + 1;
+}
+
+int QTftpPacket::writeError(char *buffer, int capacity, quint16 code, const QString &message)
+{
+    if (capacity < TFTP_HEADER_SIZE + 1)
+        return -1;
+    write16(buffer, Error);
+    write16(buffer+2, code);
+    const int length = qMin(message.size(), capacity - TFTP_HEADER_SIZE - 1);
+    const QChar *chars = message.constData();
+    char *text = buffer + TFTP_HEADER_SIZE;
+    for (int i = 0; i < length; i++) {
+        const char c = chars[i].toLatin1();
+        text[i] = c != '\0' ? c : '?';
+    }
+    text[length] = '\0';
+    return TFTP_HEADER_SIZE + length + 1;
+}
+
+int QTftpPacket::writeRequest(char *buffer, int capacity, quint16 opCode, const QString &file, const char *mode)
+{
+    /* file\0mode\0, the name is converted in place */
+    const int fileLength = file.size();
+    if (fileLength == 0 || 2 + fileLength + 1 > capacity)
+        return -1;
+    write16(buffer, opCode);
+    const QChar *chars = file.constData();
+    for (int i = 0; i < fileLength; i++) {
+        const char c = chars[i].toLatin1();
+        if (c == '\0')
+            return -1;
+        buffer[2+i] = c;
+    }
+    buffer[2+fileLength] = '\0';
+    return appendString(buffer, capacity, 2 + fileLength + 1, mode, qstrlen(mode));
+}
+
+int QTftpPacket::writeOptionAcknowledgment(char *buffer, int capacity, const char *options, int optionsSize)
+{
+    if (2 + optionsSize > capacity)
+        return -1;
+    write16(buffer, OptionAcknowledgment);
+    memcpy(buffer+2, options, optionsSize);
+    return 2 + optionsSize;
+}
+
+int QTftpPacket::appendOption(char *buffer, int capacity, int offset, const char *name, quint64 value)
+{
+    /* Digits are produced backwards, 20 are enough for any quint64 */
+    char digits[20];
+    int count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    return appendOption(buffer, capacity, offset, name, digits + sizeof(digits) - count, count);
+}
+
+int QTftpPacket::appendOption(char *buffer, int capacity, int offset, const char *name,
+                              const char *value, int valueSize)
+{
+    offset = appendString(buffer, capacity, offset, name, qstrlen(name));
+    return appendString(buffer, capacity, offset, value, valueSize);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Encoding and decoding of TFTP packets (RFC 1350, 2347). The parsers look
+ * at a received datagram in place and check every length against its
+ * size, so a malformed datagram is refused instead of read past. The
+ * builders write straight into a buffer of the caller, usually one from
+ * the QTftpPacketPool. All fields are big endian.
+ *
+ */
+
+#ifndef QTFTPPACKET_H
+#define QTFTPPACKET_H
+#include <QtGlobal>
+#include <QtEndian>
+#include <QString>
+
+/* Opcode and block number or error code */
+#define TFTP_HEADER_SIZE 4
+/* Largest request or OACK a peer has to accept (RFC 2347) */
+#define TFTP_MAX_REQUEST_SIZE 512
+
+/* A string inside a received packet, neither owned nor terminated */
+struct QTftpPacketString
+{
+    const char *data;
+    int size;
+
+    /* Modes and option names are case insensitive */
+    bool equals(const char *other) const;
+    /* Plain decimal digits no larger than maximum */
+    bool toNumber(quint64 maximum, quint64 *value) const;
+    QString toString() const {
+        return QString::fromLatin1(data, size);
+    }
+};
+
+class QTftpPacket
+{
+public:
+    /* Same values as QTftp::OpCode */
+    enum OpCode {
+        ReadRequest = 1,
+        WriteRequest = 2,
+        Data = 3,
+        Acknowledgment = 4,
+        Error = 5,
+        OptionAcknowledgment = 6
+    };
+
+    static inline quint16 read16(const char *data) {
+        return qFromBigEndian<quint16>((const uchar *) data);
+    }
+    static inline void write16(char *data, quint16 value) {
+        qToBigEndian<quint16>(value, (uchar *) data);
+    }
+
+    /*
+     * Block numbers are counted with 64 bits, the wire carries them modulo
+     * 65536. With wrap 1, the number following 65535 is 1 instead of 0.
+     */
+    static quint16 wireBlock(qint64 block, quint16 wrap);
+    /* The block closest to reference that goes by this wire number, at most half a cycle away */
+    static qint64 blockFromWire(quint16 block, qint64 reference, quint16 wrap);
+
+    /* 0 if the datagram is too short to carry an opcode */
+    static inline quint16 opCode(const char *packet, int size) {
+        return size >= 2 ? read16(packet) : 0;
+    }
+
+    /* The payload of a DATA packet may be empty */
+    static bool parseData(const char *packet, int size, quint16 *block, const char **payload, int *payloadSize);
+    static bool parseAcknowledgment(const char *packet, int size, quint16 *block);
+    /* The message ends at its terminator or with the datagram, whichever comes first */
+    static bool parseError(const char *packet, int size, quint16 *code, QTftpPacketString *message);
+    /* RRQ and WRQ, *options is where nextOption() starts */
+    static bool parseRequest(const char *packet, int size, QTftpPacketString *file,
+                             QTftpPacketString *mode, int *options);
+    /*
+     * Reads the option at *offset of a request or OACK and moves past it.
+     * Returns false at the end of the packet and on an option that is not
+     * terminated, anything behind it is ignored.
+     */
+    static bool nextOption(const char *packet, int size, int *offset,
+                           QTftpPacketString *name, QTftpPacketString *value);
+
+    /* buffer has to hold TFTP_HEADER_SIZE bytes */
+    static inline void writeDataHeader(char *buffer, quint16 block) {
+        write16(buffer, Data);
+        write16(buffer+2, block);
+    }
+    static inline int writeAcknowledgment(char *buffer, quint16 block) {
+        write16(buffer, Acknowledgment);
+        write16(buffer+2, block);
+        return TFTP_HEADER_SIZE;
+    }
+    /*
+     * The following return the size written so far, or -1 if it would not
+     * fit into capacity. An error message is cut short instead.
+     */
+    static int writeError(char *buffer, int capacity, quint16 code, const QString &message);
+    static int writeRequest(char *buffer, int capacity, quint16 opCode, const QString &file, const char *mode);
+    static int writeOptionAcknowledgment(char *buffer, int capacity, const char *options, int optionsSize);
+    static int appendOption(char *buffer, int capacity, int offset, const char *name, quint64 value);
+    static int appendOption(char *buffer, int capacity, int offset, const char *name,
+                            const char *value, int valueSize);
+
+private:
+    static int appendString(char *buffer, int capacity, int offset, const char *string, int size);
+    static int terminatedLength(const char *packet, int size, int offset);
+};
+
+#endif // QTFTPPACKET_H
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftppacketpool.h"
+
+/* Requests, ACKs and the odd error packet */
+#define TFTP_SMALL_PACKET_RESERVE 4
+
+QTftpPacketPool::QTftpPacketPool() :
+    m_largeCapacity(TFTP_SMALL_PACKET_SIZE),
+    m_misses(0)
+{
+    m_small.reserve(TFTP_SMALL_PACKET_RESERVE);
+    for (int i = 0; i < TFTP_SMALL_PACKET_RESERVE; i++)
+        m_small.append(allocate(TFTP_SMALL_PACKET_SIZE));
+}
+
+QTftpPacketPool::~QTftpPacketPool()
+{
+    foreach (QTftpPacketBuffer *buffer, m_small)
+        destroy(buffer);
+    foreach (QTftpPacketBuffer *buffer, m_large)
+        destroy(buffer);
+}
+
+void QTftpPacketPool::reserve(int blockSize, int count)
+{
+    int capacity = blockSize + 4;
+    QVector<QTftpPacketBuffer*> &list = capacity <= TFTP_SMALL_PACKET_SIZE ? m_small : m_large;
+    if (capacity > TFTP_SMALL_PACKET_SIZE && capacity != m_largeCapacity) {
+        /* Buffers of the old block size are freed now or when they come back */
+        foreach (QTftpPacketBuffer *buffer, m_large)
+            destroy(buffer);
+        m_large.clear();
+        m_largeCapacity = capacity;
+    }
+    /* Room for every buffer, so release() never has to grow the list */
+    list.reserve(count + TFTP_SMALL_PACKET_RESERVE);
+    while (list.size() < count)
+        list.append(allocate(qMax(capacity, (int) TFTP_SMALL_PACKET_SIZE)));
+}
+
+QTftpPacketBuffer *QTftpPacketPool::acquire(int size)
+{
+    QTftpPacketBuffer *buffer;
+    if (size <= TFTP_SMALL_PACKET_SIZE) {
+        if (m_small.isEmpty()) {
+            m_misses++;
+            buffer = allocate(TFTP_SMALL_PACKET_SIZE);
+        } else {
+            buffer = m_small.last();
+            m_small.pop_back();
+        }
+    } else {
+        if (size > m_largeCapacity || m_large.isEmpty()) {
+            m_misses++;
+            buffer = allocate(qMax(size, m_largeCapacity));
+        } else {
+            buffer = m_large.last();
+            m_large.pop_back();
+        }
+    }
+    buffer->size = 0;
+    return buffer;
+}
+
+void QTftpPacketPool::release(QTftpPacketBuffer *buffer)
+{
+    if (buffer == NULL)
+        return;
+    if (buffer->capacity == TFTP_SMALL_PACKET_SIZE)
+        m_small.append(buffer);
+    else if (buffer->capacity == m_largeCapacity)
+        m_large.append(buffer);
+    else
+        destroy(buffer);
+}
+
+QTftpPacketBuffer *QTftpPacketPool::allocate(int capacity)
+{
+    QTftpPacketBuffer *buffer = new QTftpPacketBuffer;
+    buffer->data = new char[capacity];
+    buffer->capacity = capacity;
+    buffer->size = 0;
+    return buffer;
+}
+
+void QTftpPacketPool::destroy(QTftpPacketBuffer *buffer)
+{
+    delete[] buffer->data;
+    delete buffer;
+}
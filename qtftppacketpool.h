@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Preallocated packet buffers, so a running transfer does not touch the heap.
+ * There are two size classes: small buffers for requests, ACKs, errors and
+ * 512 byte DATA blocks, and large buffers for DATA blocks of the negotiated
+ * block size. The pool only allocates when it runs dry, which does not
+ * happen once it has been reserved for the window size.
+ *
+ */
+
+#ifndef QTFTPPACKETPOOL_H
+#define QTFTPPACKETPOOL_H
+#include <QVector>
+
+/* opcode, block and a 512 byte payload, large enough for any request or OACK */
+#define TFTP_SMALL_PACKET_SIZE 516
+
+struct QTftpPacketBuffer
+{
+    char *data;
+    int capacity;
+    int size;
+};
+
+class QTftpPacketPool
+{
+public:
+    QTftpPacketPool();
+    ~QTftpPacketPool();
+
+    /* Keep at least count buffers for DATA packets carrying blockSize bytes */
+    void reserve(int blockSize, int count);
+    /* Never returns NULL, size is the largest packet that will be written */
+    QTftpPacketBuffer *acquire(int size);
+    void release(QTftpPacketBuffer *buffer);
+
+    int largeCapacity() const {
+        return m_largeCapacity;
+    }
+    /* Number of times a buffer had to be allocated while the pool was empty */
+    int misses() const {
+        return m_misses;
+    }
+
+private:
+    Q_DISABLE_COPY(QTftpPacketPool)
+
+    QTftpPacketBuffer *allocate(int capacity);
+    void destroy(QTftpPacketBuffer *buffer);
+
+    QVector<QTftpPacketBuffer*> m_small;
+    QVector<QTftpPacketBuffer*> m_large;
+    int m_largeCapacity;
+    int m_misses;
+};
+
+#endif // QTFTPPACKETPOOL_H
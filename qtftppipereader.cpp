@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftppipereader.h"
+#include <QSocketNotifier>
+#include <string.h>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+QTftpPipeReader::QTftpPipeReader(int descriptor, QObject *parent) :
+    QIODevice(parent),
+    m_descriptor(descriptor),
+    m_notifier(NULL),
+    m_flags(-1),
+    m_finished(false)
+{
+}
+
+QTftpPipeReader::~QTftpPipeReader()
+{
+    close();
+}
+
+bool QTftpPipeReader::open(QIODevice::OpenMode mode)
+{
+    if ((mode & WriteOnly) != 0 || isOpen())
+        return false;
+#ifdef Q_OS_UNIX
+    const int flags = fcntl(m_descriptor, F_GETFL);
+    if (flags < 0 || fcntl(m_descriptor, F_SETFL, flags | O_NONBLOCK) < 0) {
+        setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+    m_flags = flags;
+    m_buffer.clear();
+    m_finished = false;
+    m_notifier = new QSocketNotifier(m_descriptor, QSocketNotifier::Read, this);
+    connect(m_notifier, SIGNAL(activated(int)), this, SLOT(descriptorReadable()));
+    /* Everything is buffered here already */
+    return QIODevice::open(mode | Unbuffered);
+#else
+    setErrorString(tr("Reading a pipe without blocking is not supported on this platform"));
+    return false;
+#endif
+}
+
+void QTftpPipeReader::close()
+{
+    if (!isOpen())
+        return;
+    /* We may be closed from a slot of our own readyRead() */
+    m_notifier->setEnabled(false);
+    m_notifier->deleteLater();
+    m_notifier = NULL;
+#ifdef Q_OS_UNIX
+    /* The descriptor may be shared, e.g. with a shell */
+    if (m_flags >= 0)
+        fcntl(m_descriptor, F_SETFL, m_flags);
+#endif
+    m_flags = -1;
+    m_buffer.clear();
+    QIODevice::close();
+}
+
+qint64 QTftpPipeReader::bytesAvailable() const
+{
+    return m_buffer.size() + QIODevice::bytesAvailable();
+}
+
+bool QTftpPipeReader::atEnd() const
+{
+    return m_finished && m_buffer.isEmpty();
+}
+
+qint64 QTftpPipeReader::readData(char *data, qint64 maxSize)
+{
+    /* Like a closed socket, -1 once everything has been read */
+    if (m_buffer.isEmpty())
+        return m_finished ? -1 : 0;
+    const int size = (int) qMin<qint64>(maxSize, m_buffer.size());
+    memcpy(data, m_buffer.constData(), size);
+    m_buffer.remove(0, size);
+    /* Read ahead again now that there is room */
+    if (!m_finished && m_notifier != NULL && m_buffer.size() < TFTP_PIPE_BUFFER)
+        m_notifier->setEnabled(true);
+    return size;
+}
+
+qint64 QTftpPipeReader::writeData(const char *data, qint64 size)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return -1;
+}
+
+void QTftpPipeReader::descriptorReadable()
+{
+#ifdef Q_OS_UNIX
+    bool arrived = false;
+    char chunk[4096];
+    while (m_buffer.size() < TFTP_PIPE_BUFFER) {
+        const ssize_t readBytes = ::read(m_descriptor, chunk, sizeof(chunk));
+        if (readBytes > 0) {
+            m_buffer.append(chunk, (int) readBytes);
+            arrived = true;
+            continue;
+        }
+        if (readBytes < 0 && errno == EINTR)
+            continue;
+        if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        /* End of file, a read error ends the stream just the same */
+        if (readBytes < 0)
+            setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        m_finished = true;
+        break;
+    }
+    /* The notifier would fire again and again until the pipe is drained */
+    if (m_finished || m_buffer.size() >= TFTP_PIPE_BUFFER)
+        m_notifier->setEnabled(false);
+    if (arrived)
+        emit readyRead();
+    if (m_finished)
+        emit readChannelFinished();
+#endif
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * QTftpPipeReader reads a pipe, standard input for instance, without
+ * blocking. A QFile on the same descriptor never emits readyRead() and
+ * its read() waits for a whole block or the end of file, stalling every
+ * other session of the event loop meanwhile. Here a QSocketNotifier
+ * reports when there is something to read, which is buffered and
+ * announced with readyRead(); the end of the pipe is announced with
+ * readChannelFinished(). Reading ahead stops at TFTP_PIPE_BUFFER bytes.
+ *
+ */
+
+#ifndef QTFTPPIPEREADER_H
+#define QTFTPPIPEREADER_H
+#include <QIODevice>
+#include <QByteArray>
+
+class QSocketNotifier;
+
+/* Bytes read ahead of the consumer at most */
+#define TFTP_PIPE_BUFFER 65536
+
+class QTftpPipeReader : public QIODevice
+{
+    Q_OBJECT
+public:
+    /* descriptor stays open after close(), e.g. 0 for standard input */
+    explicit QTftpPipeReader(int descriptor, QObject *parent = 0);
+    ~QTftpPipeReader();
+
+    /* Only ReadOnly is supported, and only on Unix */
+    bool open(OpenMode mode);
+    void close();
+    bool isSequential() const {
+        return true;
+    }
+    qint64 bytesAvailable() const;
+    bool atEnd() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 size);
+
+private slots:
+    void descriptorReadable();
+
+private:
+    int m_descriptor;
+    QSocketNotifier *m_notifier;
+    /* File status flags before O_NONBLOCK was set, -1 while closed */
+    int m_flags;
+    QByteArray m_buffer;
+    bool m_finished;
+};
+
+#endif // QTFTPPIPEREADER_H
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftpprogress.h"
+
+QTftpProgressMeter::QTftpProgressMeter() :
+    m_interval(TFTP_DEFAULT_PROGRESS_INTERVAL)
+{
+    start();
+}
+
+void QTftpProgressMeter::setInterval(int interval)
+{
+    m_interval = qMax(0, interval);
+}
+
+void QTftpProgressMeter::start()
+{
+    m_clock.start();
+    m_lastReport = -1;
+    m_lastDone = 0;
+    m_progress = QTftpProgress();
+}
+
+bool QTftpProgressMeter::update(qint64 done, qint64 total, int retransmissions, bool force)
+{
+    const qint64 now = m_clock.elapsed();
+    /* The first update is reported right away, so the total shows up early */
+    if (!force && m_lastReport >= 0 && now - m_lastReport < m_interval)
+        return false;
+    const qint64 since = now - qMax(m_lastReport, (qint64) 0);
+    m_progress.done = done;
+    m_progress.total = total;
+    m_progress.elapsed = now;
+    m_progress.retransmissions = retransmissions;
+    if (since > 0)
+        m_progress.currentRate = (done - m_lastDone) * 1000.0 / since;
+    m_progress.averageRate = now > 0 ? done * 1000.0 / now : 0;
+    /* The current rate reacts to a stall, the average keeps the estimate steady */
+    const double rate = m_progress.currentRate > 0 ? (m_progress.currentRate + m_progress.averageRate) / 2 : m_progress.averageRate;
+    if (total > 0 && done >= total)
+        m_progress.eta = 0;
+    else if (total > 0 && rate > 0)
+        m_progress.eta = (qint64) ((total - done) * 1000.0 / rate);
+    else
+        m_progress.eta = -1;
+    m_lastReport = now;
+    m_lastDone = done;
+    return true;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * QTftpProgressMeter turns the per block progress of a transfer into at most
+ * one QTftpProgress per interval. Redrawing a progress bar for every block
+ * costs more than sending the block, especially with many sessions.
+ *
+ */
+
+#ifndef QTFTPPROGRESS_H
+#define QTFTPPROGRESS_H
+#include <QtGlobal>
+#include <QElapsedTimer>
+#include <QMetaType>
+
+#define TFTP_DEFAULT_PROGRESS_INTERVAL 100
+
+struct QTftpProgress {
+    QTftpProgress() :
+        done(0), total(0), elapsed(0), currentRate(0), averageRate(0), eta(-1), retransmissions(0) {}
+    /* Bytes transferred so far and in total, total is 0 while unknown */
+    qint64 done;
+    qint64 total;
+    /* Since the transfer started, in ms */
+    qint64 elapsed;
+    /* Bytes per second since the previous report and since the start */
+    double currentRate;
+    double averageRate;
+    /* Estimated time left in ms, -1 while it can't be told */
+    qint64 eta;
+    int retransmissions;
+};
+
+Q_DECLARE_METATYPE(QTftpProgress)
+
+class QTftpProgressMeter
+{
+public:
+    QTftpProgressMeter();
+
+    /* Minimum time between two reports in ms, 0 reports every update */
+    void setInterval(int interval);
+    int interval() const {
+        return m_interval;
+    }
+    void start();
+    /*
+     * Returns true if a report is due, which is then available as progress().
+     * The last update of a transfer should be forced, so the final numbers
+     * are never swallowed.
+     */
+    bool update(qint64 done, qint64 total, int retransmissions, bool force = false);
+    const QTftpProgress &progress() const {
+        return m_progress;
+    }
+
+private:
+    QElapsedTimer m_clock;
+    int m_interval;
+    qint64 m_lastReport;
+    qint64 m_lastDone;
+    QTftpProgress m_progress;
+};
+
+#endif // QTFTPPROGRESS_H
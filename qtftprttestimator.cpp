@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftprttestimator.h"
+#include <qmath.h>
+
+QTftpRttEstimator::QTftpRttEstimator() :
+    m_initialRto(TFTP_INITIAL_RTO),
+    m_minRto(TFTP_MIN_RTO),
+    m_maxRto(TFTP_MAX_RTO),
+    m_agreedRto(0)
+{
+    reset();
+}
+
+void QTftpRttEstimator::setBounds(int minRto, int maxRto)
+{
+    if (minRto < 1)
+        minRto = 1;
+    if (maxRto < minRto)
+        maxRto = minRto;
+    m_minRto = minRto;
+    m_maxRto = maxRto;
+    m_rto = clamp(m_rto);
+}
+
+void QTftpRttEstimator::setAgreedTimeout(int timeout)
+{
+    m_agreedRto = qMax(0, timeout);
+    m_rto = clamp(m_hasSample || m_agreedRto == 0 ? m_rto : m_agreedRto);
+}
+
+void QTftpRttEstimator::setInitialRto(int rto)
+{
+    m_initialRto = rto > 0 ? rto : TFTP_INITIAL_RTO;
+    if (!m_hasSample)
+        m_rto = clamp(m_agreedRto > 0 ? m_agreedRto : m_initialRto);
+}
+
+void QTftpRttEstimator::reset()
+{
+    m_hasSample = false;
+    m_srtt = 0;
+    m_rttvar = 0;
+    m_rto = clamp(m_initialRto);
+}
+
+void QTftpRttEstimator::addSample(qint64 rtt)
+{
+    if (rtt < 0)
+        return;
+    if (!m_hasSample) {
+        m_srtt = rtt;
+        m_rttvar = rtt / 2.0;
+        m_hasSample = true;
+    } else {
+        /* alpha = 1/8, beta = 1/4 */
+        m_rttvar = 0.75 * m_rttvar + 0.25 * qAbs(m_srtt - rtt);
+        m_srtt = 0.875 * m_srtt + 0.125 * rtt;
+    }
+    /* The clock granularity is one millisecond */
+    m_rto = clamp(m_srtt + qMax(1.0, 4 * m_rttvar));
+}
+
+void QTftpRttEstimator::backoff()
+{
+    m_rto = clamp(2.0 * m_rto);
+}
+
+int QTftpRttEstimator::smoothedRtt() const
+{
+    return m_hasSample ? qRound(m_srtt) : -1;
+}
+
+int QTftpRttEstimator::rttVariation() const
+{
+    return m_hasSample ? qRound(m_rttvar) : -1;
+}
+
+int QTftpRttEstimator::clamp(double rto) const
+{
+    int maxRto = m_maxRto;
+    if (m_agreedRto > 0)
+        maxRto = qMax(m_minRto, qMin(maxRto, m_agreedRto));
+    return qBound(m_minRto, (int) qCeil(rto), maxRto);
+}
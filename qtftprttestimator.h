@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Retransmission timeout estimation as described by Jacobson/Karels and
+ * RFC 6298. Karn's rule (no samples from retransmitted packets) has to be
+ * applied by the caller, who is the only one knowing what has been resent.
+ *
+ */
+
+#ifndef QTFTPRTTESTIMATOR_H
+#define QTFTPRTTESTIMATOR_H
+#include <QtGlobal>
+
+#define TFTP_INITIAL_RTO 1000
+#define TFTP_MIN_RTO 50
+#define TFTP_MAX_RTO 10000
+
+class QTftpRttEstimator
+{
+public:
+    QTftpRttEstimator();
+
+    void setBounds(int minRto, int maxRto);
+    int minimumRto() const {
+        return m_minRto;
+    }
+    int maximumRto() const {
+        return m_maxRto;
+    }
+    /*
+     * Timeout agreed on with the peer (RFC 2349) in ms, 0 for none. It is used
+     * until the first sample arrives and never exceeded, as the peer retransmits
+     * after that time itself.
+     */
+    void setAgreedTimeout(int timeout);
+    int agreedTimeout() const {
+        return m_agreedRto;
+    }
+    /* Timeout before the first sample, e.g. one learned earlier for the same peer */
+    void setInitialRto(int rto);
+    int initialRto() const {
+        return m_initialRto;
+    }
+    /* Forget all samples, the next timeout is the initial one again */
+    void reset();
+    void addSample(qint64 rtt);
+    /* Double the timeout after it expired (exponential backoff) */
+    void backoff();
+    int rto() const {
+        return m_rto;
+    }
+    /* Both return -1 as long as there is no sample */
+    int smoothedRtt() const;
+    int rttVariation() const;
+
+private:
+    int clamp(double rto) const;
+
+    bool m_hasSample;
+    double m_srtt;
+    double m_rttvar;
+    int m_rto;
+    int m_initialRto;
+    int m_minRto;
+    int m_maxRto;
+    int m_agreedRto;
+};
+
+#endif // QTFTPRTTESTIMATOR_H
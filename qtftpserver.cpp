@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftpserver.h"
+#include "qtftplogging.h"
+#include <QDir>
+#include <QFileInfo>
+
+QTftpServer::QTftpServer(QObject *parent) :
+    QObject(parent),
+    m_socket(NULL),
+    m_root(QDir::current().canonicalPath()),
+    m_maxBlockSize(TFTP_MAX_BLOCKSIZE),
+    m_maxWindowSize(TFTP_PIPELINE_WINDOWSIZE),
+    m_blockWrap(TFTP_DEFAULT_BLOCK_WRAP),
+    m_pacingBurst(0),
+    m_pacingGap(0),
+    m_pacingAutoTune(false),
+    m_maxSessions(TFTP_DEFAULT_SERVER_SESSIONS),
+    m_multicastPort(TFTP_DEFAULT_MULTICAST_PORT),
+    m_rxSenderPort(0)
+{
+}
+
+QTftpServer::~QTftpServer()
+{
+    close();
+}
+
+bool QTftpServer::listen(const QHostAddress &address, quint16 port)
+{
+    close();
+    m_socket = new QUdpSocket(this);
+    if (!m_socket->bind(address, port)) {
+        tftpDebug() << "Could not bind to port" << port << m_socket->errorString();
+        delete m_socket;
+        m_socket = NULL;
+        return false;
+    }
+    m_io.setSocket(m_socket);
+    connect(m_socket, SIGNAL(readyRead()), this, SLOT(readPendingDatagrams()));
+    return true;
+}
+
+void QTftpServer::close()
+{
+    m_io.setSocket(NULL);
+    if (m_socket != NULL) {
+        m_socket->close();
+        m_socket->deleteLater();
+        m_socket = NULL;
+    }
+    QList<QObject*> running = m_keyByTftp.keys();
+    foreach (QTftp *tftp, m_multicastSessions)
+        running.append(tftp);
+    m_keyByTftp.clear();
+    m_multicastSessions.clear();
+    m_sessions.clear();
+    foreach (QObject *tftp, running) {
+        tftp->disconnect(this);
+        tftp->deleteLater();
+    }
+    m_images.clear();
+    m_imageOrder.clear();
+}
+
+quint16 QTftpServer::serverPort() const
+{
+    return m_socket != NULL ? m_socket->localPort() : 0;
+}
+
+void QTftpServer::setRootDirectory(const QString &path)
+{
+    m_root = QDir(path).canonicalPath();
+    m_images.clear();
+    m_imageOrder.clear();
+}
+
+void QTftpServer::setMaxBlockSize(quint16 size)
+{
+    if (size < TFTP_DEFAULT_BLOCKSIZE)
+        size = TFTP_DEFAULT_BLOCKSIZE;
+    if (size > TFTP_MAX_BLOCKSIZE)
+        size = TFTP_MAX_BLOCKSIZE;
+    m_maxBlockSize = size;
+}
+
+void QTftpServer::setMaxWindowSize(quint16 size)
+{
+    if (size < TFTP_DEFAULT_WINDOWSIZE)
+        size = TFTP_DEFAULT_WINDOWSIZE;
+    m_maxWindowSize = size;
+}
+
+void QTftpServer::setBlockWrap(quint16 block)
+{
+    m_blockWrap = block;
+}
+
+void QTftpServer::setPacing(int burst, int gap, bool autoTune)
+{
+    m_pacingBurst = burst;
+    m_pacingGap = gap;
+    m_pacingAutoTune = autoTune;
+}
+
+void QTftpServer::setMulticastGroup(const QHostAddress &group, quint16 port, const QNetworkInterface &iface)
+{
+    m_multicastGroup = group;
+    m_multicastPort = port;
+    m_multicastInterface = iface;
+}
+
+void QTftpServer::setMaxConcurrentSessions(int count)
+{
+    m_maxSessions = qMax(1, count);
+}
+
+QString QTftpServer::sessionKey(const QHostAddress &client, quint16 port)
+{
+    return client.toString() + QLatin1Char(':') + QString::number(port);
+}
+
+void QTftpServer::readPendingDatagrams()
+{
+    /* A burst of devices booting at once is read in batches, each request goes to its client's session */
+    const char *data;
+    int size;
+    while (m_socket != NULL && (size = m_io.readDatagram(&data, &m_rxSender, &m_rxSenderPort)) >= 0) {
+        if (size < 4)
+            continue;
+        switch (QTftpPacket::opCode(data, size)) {
+        case QTftp::ReadRequest:
+            handleReadRequest(data, size, m_rxSender, m_rxSenderPort);
+            break;
+        case QTftp::WriteRequest:
+            sendError(QTftp::AccessViolation, tr("Server is read-only"), m_rxSender, m_rxSenderPort);
+            break;
+        default:
+            /* Everything else belongs to a session port */
+            sendError(QTftp::IllegalOP, tr("Illegal TFTP operation"), m_rxSender, m_rxSenderPort);
+            break;
+        }
+    }
+}
+
+void QTftpServer::handleReadRequest(const char *packet, int size, const QHostAddress &client, quint16 port)
+{
+    const QString key = sessionKey(client, port);
+    /* A client resends its RRQ until the first block arrives, the session already answers */
+    if (m_sessions.contains(key)) {
+        /* Multicast OACKs of listeners aren't retransmitted, so repeat it */
+        const Session &session = m_sessions[key];
+        if (session.multicast)
+            session.tftp->addMulticastClient(client, port, TFTP_DEFAULT_WINDOWSIZE, QByteArray());
+        return;
+    }
+
+    QTftpPacketString fileName;
+    QTftpPacketString mode;
+    int offset;
+    if (!QTftpPacket::parseRequest(packet, size, &fileName, &mode, &offset)) {
+        sendError(QTftp::IllegalOP, tr("Malformed request"), client, port);
+        return;
+    }
+    if (!mode.equals("octet")) {
+        sendError(QTftp::IllegalOP, tr("Transfer mode not supported"), client, port);
+        return;
+    }
+    const QString file = fileName.toString();
+
+    /* Options (RFC 2347), unknown ones are ignored */
+    quint16 blockSize = TFTP_DEFAULT_BLOCKSIZE;
+    quint16 windowSize = TFTP_DEFAULT_WINDOWSIZE;
+    int timeout = 0;
+    bool transferSize = false;
+    bool multicast = false;
+    QByteArray optionAck;
+    QTftpPacketString name;
+    QTftpPacketString value;
+    while (QTftpPacket::nextOption(packet, size, &offset, &name, &value)) {
+        if (name.equals("multicast")) {
+            /* RFC 2090, the client leaves the value empty */
+            multicast = true;
+            continue;
+        }
+        quint64 number = 0;
+        if (!value.toNumber(Q_INT64_C(0x7fffffffffffffff), &number))
+            continue;
+        if (name.equals("blksize") && number >= TFTP_MIN_BLOCKSIZE) {
+            blockSize = qMin<quint64>(number, m_maxBlockSize);
+            optionAck.append("blksize").append('\0');
+            optionAck.append(QByteArray::number(blockSize)).append('\0');
+        } else if (name.equals("windowsize") && number >= TFTP_DEFAULT_WINDOWSIZE) {
+            windowSize = qMin<quint64>(number, m_maxWindowSize);
+            optionAck.append("windowsize").append('\0');
+            optionAck.append(QByteArray::number(windowSize)).append('\0');
+        } else if (name.equals("timeout") && number >= 1 && number <= TFTP_MAX_TIMEOUT) {
+            timeout = number;
+            optionAck.append("timeout").append('\0');
+            optionAck.append(QByteArray::number(timeout)).append('\0');
+        } else if (name.equals("tsize")) {
+            /* Answered below, once we know the file */
+            transferSize = true;
+        }
+    }
+
+    if (m_sessions.size() >= m_maxSessions) {
+        sendError(QTftp::NotDefined, tr("Server busy"), client, port);
+        return;
+    }
+    QString path;
+    QTftpImage source = image(file, &path);
+    if (source.isNull()) {
+        sendError(QTftp::FileNotFound, tr("File not found"), client, port);
+        return;
+    }
+    Session session;
+    session.client = client;
+    session.port = port;
+    session.file = file;
+    session.multicast = true;
+    /* Otherwise the client gets a unicast transfer, as it didn't see the option acknowledged */
+    if (multicast && !m_multicastGroup.isNull()
+            && joinMulticastGroup(session, path, source, blockSize, windowSize, timeout, transferSize))
+        return;
+
+    if (transferSize) {
+        optionAck.append("tsize").append('\0');
+        optionAck.append(QByteArray::number(source.size())).append('\0');
+    }
+
+    QTftp *tftp = new QTftp(this);
+    tftp->setBlockWrap(m_blockWrap);
+    tftp->setPacing(m_pacingBurst, m_pacingGap, m_pacingAutoTune);
+    connect(tftp, SIGNAL(done(bool)), this, SLOT(sessionDone(bool)));
+    session.tftp = tftp;
+    session.multicast = false;
+    m_sessions.insert(key, session);
+    m_keyByTftp.insert(tftp, key);
+    tftpDebug() << "RRQ" << file << "from" << key;
+    emit sessionStarted(client, port, file);
+    if (tftp->serve(client, port, source, blockSize, windowSize, timeout, optionAck) != 0) {
+        m_sessions.remove(key);
+        m_keyByTftp.remove(tftp);
+        tftp->deleteLater();
+        sendError(QTftp::NotDefined, tr("Could not start transfer"), client, port);
+        emit sessionFinished(client, port, file, true);
+    }
+}
+
+bool QTftpServer::joinMulticastGroup(const Session &session, const QString &path, const QTftpImage &source,
+                                     quint16 blockSize, quint16 windowSize, int timeout, bool transferSize)
+{
+    QTftp *tftp = m_multicastSessions.value(path);
+    if (tftp == NULL) {
+        /* The first client decides on block size and timeout of the group */
+        tftp = new QTftp(this);
+        if (tftp->serveMulticast(m_multicastGroup, m_multicastPort, m_multicastInterface,
+                                 source, blockSize, timeout) != 0) {
+            delete tftp;
+            return false;
+        }
+        connect(tftp, SIGNAL(done(bool)), this, SLOT(sessionDone(bool)));
+        connect(tftp, SIGNAL(multicastClientFinished(QHostAddress,quint16,bool)),
+                this, SLOT(multicastClientFinished(QHostAddress,quint16,bool)));
+        m_multicastSessions.insert(path, tftp);
+    } else if (tftp->blockSize() > blockSize) {
+        /* We may only answer with a smaller block size than the client asked for */
+        return false;
+    }
+
+    QByteArray options;
+    if (tftp->blockSize() != TFTP_DEFAULT_BLOCKSIZE) {
+        options.append("blksize").append('\0');
+        options.append(QByteArray::number(tftp->blockSize())).append('\0');
+    }
+    /* A client asking for another timeout than the group's just doesn't get one */
+    if (timeout > 0 && timeout == tftp->timeoutInterval()) {
+        options.append("timeout").append('\0');
+        options.append(QByteArray::number(timeout)).append('\0');
+    }
+    if (transferSize) {
+        options.append("tsize").append('\0');
+        options.append(QByteArray::number(source.size())).append('\0');
+    }
+    const QString key = sessionKey(session.client, session.port);
+    Session member = session;
+    member.tftp = tftp;
+    m_sessions.insert(key, member);
+    tftpDebug() << "Multicast RRQ" << session.file << "from" << key;
+    emit sessionStarted(session.client, session.port, session.file);
+    tftp->addMulticastClient(session.client, session.port, windowSize, options);
+    return true;
+}
+
+void QTftpServer::multicastClientFinished(const QHostAddress &client, quint16 port, bool error)
+{
+    const QString key = sessionKey(client, port);
+    if (!m_sessions.contains(key) || m_sessions.value(key).tftp != sender())
+        return;
+    const Session session = m_sessions.take(key);
+    emit sessionFinished(client, port, session.file, error);
+}
+
+void QTftpServer::sessionDone(bool error)
+{
+    QObject *tftp = sender();
+    const QString path = m_multicastSessions.key(qobject_cast<QTftp*>(tftp));
+    if (!path.isEmpty()) {
+        m_multicastSessions.remove(path);
+        /* Normally every client was reported already */
+        foreach (const QString &key, m_sessions.keys()) {
+            if (m_sessions.value(key).tftp != tftp)
+                continue;
+            const Session session = m_sessions.take(key);
+            emit sessionFinished(session.client, session.port, session.file, true);
+        }
+        tftp->disconnect(this);
+        tftp->deleteLater();
+        return;
+    }
+    if (!m_keyByTftp.contains(tftp))
+        return;
+    const Session session = m_sessions.take(m_keyByTftp.take(tftp));
+    tftp->disconnect(this);
+    tftp->deleteLater();
+    emit sessionFinished(session.client, session.port, session.file, error);
+}
+
+QTftpImage QTftpServer::image(const QString &file, QString *path)
+{
+    /* Resolve below the root and refuse anything that ends up outside of it */
+    QString relative = file;
+    while (relative.startsWith(QLatin1Char('/')) || relative.startsWith(QLatin1Char('\\')))
+        relative.remove(0, 1);
+    const QString canonical = QFileInfo(QDir(m_root), relative).canonicalFilePath();
+    QString prefix = m_root;
+    if (!prefix.endsWith(QLatin1Char('/')))
+        prefix.append(QLatin1Char('/'));
+    if (canonical.isEmpty() || !canonical.startsWith(prefix) || !QFileInfo(canonical).isFile())
+        return QTftpImage();
+
+    /*
+     * map() shares one mapping per file, the cache keeps it alive while idle.
+     * A replaced file gets a new mapping, the old one goes with its sessions.
+     */
+    QTftpImage current = QTftpImage::map(canonical);
+    if (current.isNull())
+        return current;
+    m_images.insert(canonical, current);
+    m_imageOrder.removeOne(canonical);
+    m_imageOrder.append(canonical);
+    while (m_imageOrder.size() > TFTP_SERVER_IMAGE_CACHE)
+        m_images.remove(m_imageOrder.takeFirst());
+    *path = canonical;
+    return current;
+}
+
+void QTftpServer::sendError(QTftp::TFtpErrorCode code, const QString &message,
+                            const QHostAddress &client, quint16 port)
+{
+    if (m_socket == NULL)
+        return;
+    char packet[TFTP_SMALL_PACKET_SIZE];
+    const int size = QTftpPacket::writeError(packet, sizeof(packet), code, message);
+    m_socket->writeDatagram(packet, size, client, port);
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * A read-only TFTP server. Every RRQ gets a QTftp session of its own, which
+ * answers from a new port (TID) as required by RFC 1350, so any number of
+ * clients can be served at once. Files are served out of a cache of mapped
+ * QTftpImages: a popular image is read from disk once, no matter how many
+ * devices pull it. The cache holds the files requested last, every other
+ * mapping is released with the last session sending it. Write requests
+ * are refused. Update files below the root directory by renaming a new
+ * file over the old one, see QTftpImage.
+ *
+ * With a multicast group set, clients asking for it (RFC 2090) share one
+ * stream per file: the server sends to the group and one master client at
+ * a time acknowledges, everybody else just listens and catches up on what
+ * it missed once it becomes master.
+ *
+ */
+
+#ifndef QTFTPSERVER_H
+#define QTFTPSERVER_H
+#include <QObject>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QNetworkInterface>
+#include <QUdpSocket>
+#include "qtftp.h"
+
+#define TFTP_DEFAULT_SERVER_SESSIONS 256
+/* Idle images kept mapped, each costs a file descriptor and address space */
+#define TFTP_SERVER_IMAGE_CACHE 8
+/* tftp-mcast as registered with IANA */
+#define TFTP_DEFAULT_MULTICAST_PORT 1758
+
+class QTftpServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QTftpServer(QObject *parent = 0);
+    virtual ~QTftpServer();
+
+    bool listen(const QHostAddress &address = QHostAddress::Any, quint16 port = 69);
+    void close();
+    bool isListening() const {
+        return m_socket != NULL;
+    }
+    quint16 serverPort() const;
+
+    /* Files are only served from below this directory */
+    void setRootDirectory(const QString &path);
+    QString rootDirectory() const {
+        return m_root;
+    }
+    /* Upper limits for what clients may negotiate */
+    void setMaxBlockSize(quint16 size);
+    void setMaxWindowSize(quint16 size);
+    /* Block number after 65535 for files of more blocks, see QTftp::setBlockWrap() */
+    void setBlockWrap(quint16 block);
+    /* Pacing of the unicast sessions, see QTftp::setPacing() */
+    void setPacing(int burst, int gap, bool autoTune = false);
+    /*
+     * Group and port to send multicast transfers to, out of iface (the default
+     * one if invalid). A null group (the default) disables multicast.
+     */
+    void setMulticastGroup(const QHostAddress &group, quint16 port = TFTP_DEFAULT_MULTICAST_PORT,
+                           const QNetworkInterface &iface = QNetworkInterface());
+    QHostAddress multicastGroup() const {
+        return m_multicastGroup;
+    }
+    /* Requests beyond this number of running sessions are refused */
+    void setMaxConcurrentSessions(int count);
+    int activeSessions() const {
+        return m_sessions.size();
+    }
+
+signals:
+    void sessionStarted(const QHostAddress &client, quint16 port, const QString &file);
+    void sessionFinished(const QHostAddress &client, quint16 port, const QString &file, bool error);
+
+private slots:
+    void readPendingDatagrams();
+    void sessionDone(bool error);
+    void multicastClientFinished(const QHostAddress &client, quint16 port, bool error);
+
+private:
+    struct Session {
+        QTftp *tftp;
+        QHostAddress client;
+        quint16 port;
+        QString file;
+        /* tftp is shared by all clients of the file's multicast group */
+        bool multicast;
+    };
+
+    void handleReadRequest(const char *packet, int size, const QHostAddress &client, quint16 port);
+    bool joinMulticastGroup(const Session &session, const QString &path, const QTftpImage &source,
+                            quint16 blockSize, quint16 windowSize, int timeout, bool transferSize);
+    void sendError(QTftp::TFtpErrorCode code, const QString &message, const QHostAddress &client, quint16 port);
+    QTftpImage image(const QString &file, QString *path);
+    static QString sessionKey(const QHostAddress &client, quint16 port);
+
+private:
+    QUdpSocket *m_socket;
+    QString m_root;
+    quint16 m_maxBlockSize;
+    quint16 m_maxWindowSize;
+    quint16 m_blockWrap;
+    int m_pacingBurst;
+    int m_pacingGap;
+    bool m_pacingAutoTune;
+    int m_maxSessions;
+    QHostAddress m_multicastGroup;
+    quint16 m_multicastPort;
+    QNetworkInterface m_multicastInterface;
+
+    /* Running sessions by client address and port, to ignore repeated requests */
+    QHash<QString, Session> m_sessions;
+    QHash<QObject*, QString> m_keyByTftp;
+    /* Multicast sessions by the canonical path of their file */
+    QHash<QString, QTftp*> m_multicastSessions;
+    /* Keeps the mappings alive between two requests for the same file, least recently used first */
+    QHash<QString, QTftpImage> m_images;
+    QList<QString> m_imageOrder;
+
+    /* Requests are at most 512 bytes (RFC 2347), the default datagram size */
+    QTftpBatchIO m_io;
+    QHostAddress m_rxSender;
+    quint16 m_rxSenderPort;
+};
+
+#endif // QTFTPSERVER_H
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftpsessionmanager.h"
+
+QTftpSessionManager::QTftpSessionManager(QObject *parent) :
+    QObject(parent),
+    m_maxConcurrent(TFTP_DEFAULT_CONCURRENT_SESSIONS),
+    m_nextId(1),
+    m_blockSize(TFTP_ETHERNET_BLOCKSIZE),
+    m_windowSize(TFTP_PIPELINE_WINDOWSIZE),
+    m_minRto(TFTP_MIN_RTO),
+    m_maxRto(TFTP_MAX_RTO),
+    m_maxRetries(TFTP_DEFAULT_RETRIES),
+    m_timeoutInterval(0),
+    m_armedInterval(0),
+    m_armedTimeout(TFTP_DEFAULT_ARMED_TIMEOUT),
+    m_blockWrap(TFTP_DEFAULT_BLOCK_WRAP),
+    m_pacingBurst(0),
+    m_pacingGap(0),
+    m_pacingAutoTune(false),
+    m_multicast(false),
+    m_verify(false),
+    m_skipIdentical(false),
+    m_deviceProfiles(false),
+    m_finishedDone(0),
+    m_finishedTotal(0),
+    m_finishedRetransmissions(0),
+    m_batchError(false)
+{
+}
+
+QTftpSessionManager::~QTftpSessionManager()
+{
+    qDeleteAll(m_pending);
+    foreach (Session *session, m_active) {
+        session->tftp->disconnect(this);
+        delete session->tftp;
+        delete session->sink;
+        delete session;
+    }
+}
+
+void QTftpSessionManager::setMaxConcurrentSessions(int count)
+{
+    m_maxConcurrent = qMax(1, count);
+    startPendingSessions();
+}
+
+void QTftpSessionManager::setBlockSize(quint16 size)
+{
+    m_blockSize = size;
+}
+
+void QTftpSessionManager::setWindowSize(quint16 size)
+{
+    m_windowSize = size;
+}
+
+void QTftpSessionManager::setRetransmitTimeout(int minimum, int maximum)
+{
+    m_minRto = minimum;
+    m_maxRto = maximum;
+}
+
+void QTftpSessionManager::setMaxRetries(int retries)
+{
+    m_maxRetries = retries;
+}
+
+void QTftpSessionManager::setTimeoutInterval(int seconds)
+{
+    m_timeoutInterval = seconds;
+}
+
+void QTftpSessionManager::setArmedMode(int interval, int timeout)
+{
+    m_armedInterval = interval;
+    m_armedTimeout = timeout;
+}
+
+void QTftpSessionManager::setBlockWrap(quint16 block)
+{
+    m_blockWrap = block;
+}
+
+void QTftpSessionManager::setPacing(int burst, int gap, bool autoTune)
+{
+    m_pacingBurst = burst;
+    m_pacingGap = gap;
+    m_pacingAutoTune = autoTune;
+}
+
+void QTftpSessionManager::setMulticast(bool enabled, const QNetworkInterface &iface)
+{
+    m_multicast = enabled;
+    m_multicastInterface = iface;
+}
+
+void QTftpSessionManager::setVerification(bool verify, bool skipIdentical)
+{
+    m_verify = verify;
+    m_skipIdentical = skipIdentical;
+}
+
+void QTftpSessionManager::setDeviceProfiles(bool enabled)
+{
+    m_deviceProfiles = enabled;
+}
+
+void QTftpSessionManager::setProgressInterval(int interval)
+{
+    m_meter.setInterval(interval);
+}
+
+int QTftpSessionManager::put(const QString &host, QIODevice *dev, const QString &file, quint16 port)
+{
+    if (dev == NULL || dev->isReadable() == false || dev->isOpen() == false)
+        return -1;
+    return enqueue(QTftp::Write, host, port, file, dev);
+}
+
+int QTftpSessionManager::put(const QString &host, const QTftpImage &image, const QString &file, quint16 port)
+{
+    if (image.isNull())
+        return -1;
+    return enqueue(QTftp::Write, host, port, file, NULL, image);
+}
+
+int QTftpSessionManager::put(const QString &host, const QByteArray &data, const QString &file, quint16 port)
+{
+    return put(host, QTftpImage(data), file, port);
+}
+
+int QTftpSessionManager::get(const QString &host, const QString &file, QIODevice *dev, quint16 port)
+{
+    if (dev == NULL || dev->isWritable() == false || dev->isOpen() == false)
+        return -1;
+    return enqueue(QTftp::Read, host, port, file, dev);
+}
+
+int QTftpSessionManager::enqueue(QTftp::Command command, const QString &host, quint16 port, const QString &file, QIODevice *dev,
+                                 const QTftpImage &image)
+{
+    if (!hasPendingCommands()) {
+        /* A new batch */
+        m_finishedDone = 0;
+        m_finishedTotal = 0;
+        m_finishedRetransmissions = 0;
+        m_batchError = false;
+        m_meter.start();
+    }
+    Session *session = new Session;
+    session->id = m_nextId++;
+    session->host = host;
+    session->port = port;
+    session->command = command;
+    session->file = file;
+    session->device = dev;
+    session->image = image;
+    session->tftp = NULL;
+    session->profiled = false;
+    session->phase = Transfer;
+    session->verify = false;
+    session->sink = NULL;
+    session->commandIssued = false;
+    session->done = 0;
+    /* Uploads know their size in advance, downloads only once they are done */
+    if (!image.isNull())
+        session->total = image.size();
+    else
+        session->total = (command == QTftp::Write && !dev->isSequential()) ? dev->size() : 0;
+    m_pending.append(session);
+    /* Let the caller connect to sessionStarted() before the first one starts */
+    QMetaObject::invokeMethod(this, "startPendingSessions", Qt::QueuedConnection);
+    return session->id;
+}
+
+void QTftpSessionManager::startPendingSessions()
+{
+    while (!m_pending.isEmpty() && m_active.size() < m_maxConcurrent)
+        startSession(m_pending.takeFirst());
+}
+
+void QTftpSessionManager::startSession(QTftpSessionManager::Session *session)
+{
+    QTftp *tftp = new QTftp(this);
+    configure(tftp);
+    if (m_deviceProfiles) {
+        const QTftpDeviceProfile profile = QTftpDeviceProfile::load(session->host);
+        profile.apply(tftp);
+        session->profiled = profile.isValid();
+    }
+    if (session->command == QTftp::Write) {
+        /* A stream can't be hashed before it has been sent */
+        session->verify = m_verify;
+        if (m_skipIdentical && !session->image.isNull())
+            session->phase = PreCheck;
+        tftp->setSourceHashing(m_verify);
+    }
+    session->tftp = tftp;
+    m_active.insert(session->id, session);
+    m_byTftp.insert(tftp, session);
+    connect(tftp, SIGNAL(stateChanged(QTftp::State)), this, SLOT(sessionStateChanged(QTftp::State)));
+    connect(tftp, SIGNAL(dataTransferProgress(qint64,qint64)), this, SLOT(sessionTransferProgress(qint64,qint64)));
+    connect(tftp, SIGNAL(done(bool)), this, SLOT(sessionDone(bool)));
+    connect(tftp, SIGNAL(error(QTftp::ErrorCode,QString)), this, SLOT(sessionError(QTftp::ErrorCode,QString)));
+    emit sessionStarted(session->id);
+    tftp->connectToHost(session->host, session->port);
+}
+
+void QTftpSessionManager::configure(QTftp *tftp)
+{
+    tftp->setBlockSize(m_blockSize);
+    tftp->setWindowSize(m_windowSize);
+    tftp->setRetransmitTimeout(m_minRto, m_maxRto);
+    tftp->setInitialRetransmitTimeout(0);
+    tftp->setMaxRetries(m_maxRetries);
+    tftp->setTimeoutInterval(m_timeoutInterval);
+    tftp->setArmedMode(m_armedInterval, m_armedTimeout);
+    tftp->setBlockWrap(m_blockWrap);
+    tftp->setPacing(m_pacingBurst, m_pacingGap, m_pacingAutoTune);
+    tftp->setMulticast(m_multicast, m_multicastInterface);
+    tftp->setProgressInterval(m_meter.interval());
+}
+
+bool QTftpSessionManager::retryWithoutProfile(QTftpSessionManager::Session *session)
+{
+    if (!session->profiled || session->tftp->getLastErrorCode() == QTftp::AbortedByUser)
+        return false;
+    /* Whatever a stream gave us is gone */
+    if (session->image.isNull() && session->device->isSequential())
+        return false;
+    QTftpDeviceProfile::forget(session->host);
+    session->profiled = false;
+    configure(session->tftp);
+    session->done = 0;
+    emit sessionProgress(session->id, session->done, session->total);
+    nextPhase(session, Transfer);
+    return true;
+}
+
+void QTftpSessionManager::issueCommand(QTftpSessionManager::Session *session)
+{
+    session->commandIssued = true;
+    int result;
+    if (session->phase != Transfer) {
+        delete session->sink;
+        session->sink = new QTftpHashSink;
+        session->sink->open(QIODevice::WriteOnly);
+        result = session->tftp->get(session->file, session->sink);
+    } else if (session->command == QTftp::Write && !session->image.isNull())
+        result = session->tftp->put(session->image, session->file);
+    else if (session->command == QTftp::Write)
+        result = session->tftp->put(session->device, session->file);
+    else
+        result = session->tftp->get(session->file, session->device);
+    if (result < 0) {
+        if (session->errorMessage.isEmpty())
+            session->errorMessage = tr("Unable to start the transfer");
+        finishSession(session, true);
+    }
+}
+
+void QTftpSessionManager::finishSession(QTftpSessionManager::Session *session, bool error)
+{
+    m_active.remove(session->id);
+    m_byTftp.remove(session->tftp);
+    /* We are usually called from one of its signals */
+    session->tftp->disconnect(this);
+    session->tftp->deleteLater();
+    if (!error)
+        session->total = qMax(session->total, session->done);
+    m_finishedDone += session->done;
+    m_finishedTotal += session->total;
+    if (session->phase != Verify)
+        session->statistics = session->tftp->statistics();
+    m_finishedRetransmissions += session->statistics.retransmissions;
+    m_batchError |= error;
+    emit sessionStatistics(session->id, session->statistics);
+    emit sessionFinished(session->id, error, session->errorMessage);
+    delete session->sink;
+    delete session;
+
+    startPendingSessions();
+    emitAggregateProgress(!hasPendingCommands());
+    if (!hasPendingCommands())
+        emit done(m_batchError);
+}
+
+void QTftpSessionManager::nextPhase(QTftpSessionManager::Session *session, QTftpSessionManager::Phase phase)
+{
+    session->phase = phase;
+    session->commandIssued = false;
+    session->errorMessage.clear();
+    /* Not from within done(), the QTftp still handles the datagram that ended the transfer */
+    QMetaObject::invokeMethod(this, "continueSession", Qt::QueuedConnection, Q_ARG(int, session->id));
+}
+
+void QTftpSessionManager::continueSession(int id)
+{
+    Session *session = m_active.value(id, NULL);
+    if (session != NULL && !session->commandIssued)
+        issueCommand(session);
+}
+
+void QTftpSessionManager::readBackDone(QTftpSessionManager::Session *session, bool error)
+{
+    if (session->phase == PreCheck) {
+        QTftpHashSink image;
+        image.open(QIODevice::WriteOnly);
+        image.write(session->image.data(), session->image.size());
+        if (error || session->sink->result() != image.result()) {
+            /* Missing, different or unreadable, so flash it */
+            nextPhase(session, Transfer);
+            return;
+        }
+        session->errorMessage = tr("Identical, skipped");
+        /* Nothing left to do for the aggregate progress */
+        session->total = 0;
+        emit sessionSkipped(session->id);
+        finishSession(session, false);
+        return;
+    }
+    if (error) {
+        session->errorMessage = tr("Reading back failed: ") + session->errorMessage;
+    } else if (session->sink->result() != session->sourceHash) {
+        session->errorMessage = tr("Verification failed, the device holds something else");
+        error = true;
+    } else {
+        session->errorMessage = tr("Verified");
+    }
+    finishSession(session, error);
+}
+
+void QTftpSessionManager::emitAggregateProgress(bool force)
+{
+    qint64 done = m_finishedDone;
+    qint64 total = m_finishedTotal;
+    int retransmissions = m_finishedRetransmissions;
+    foreach (Session *session, m_active) {
+        done += session->done;
+        total += session->total;
+        if (session->tftp != NULL)
+            retransmissions += session->tftp->retransmissions();
+    }
+    foreach (Session *session, m_pending)
+        total += session->total;
+    /* With many sessions the aggregate would otherwise change with every block */
+    if (!m_meter.update(done, total, retransmissions, force))
+        return;
+    emit dataTransferProgress(done, total);
+    emit progress(m_meter.progress());
+}
+
+QTftpSessionManager::Session *QTftpSessionManager::sessionFor(QObject *tftp) const
+{
+    return m_byTftp.value(tftp, NULL);
+}
+
+void QTftpSessionManager::sessionStateChanged(QTftp::State state)
+{
+    Session *session = sessionFor(sender());
+    if (session == NULL)
+        return;
+    if (state == QTftp::Connected && !session->commandIssued)
+        issueCommand(session);
+}
+
+void QTftpSessionManager::sessionTransferProgress(qint64 done, qint64 total)
+{
+    Session *session = sessionFor(sender());
+    if (session == NULL || session->phase != Transfer)
+        return;
+    session->done = done;
+    if (total > 0)
+        session->total = total;
+    emit sessionProgress(session->id, session->done, session->total);
+    emitAggregateProgress();
+}
+
+void QTftpSessionManager::sessionDone(bool error)
+{
+    Session *session = sessionFor(sender());
+    if (session == NULL)
+        return;
+    if (session->phase != Transfer) {
+        readBackDone(session, error);
+        return;
+    }
+    if (error && retryWithoutProfile(session))
+        return;
+    if (!error && session->command == QTftp::Read)
+        session->done = session->device->isSequential() ? session->done : session->device->size();
+    if (!error && m_deviceProfiles)
+        QTftpDeviceProfile::load(session->host).learn(session->tftp).save(session->host);
+    if (!error && session->verify) {
+        session->sourceHash = session->tftp->sourceHash();
+        session->statistics = session->tftp->statistics();
+        nextPhase(session, Verify);
+        return;
+    }
+    finishSession(session, error);
+}
+
+void QTftpSessionManager::sessionError(QTftp::ErrorCode errorCode, const QString &message)
+{
+    Q_UNUSED(errorCode);
+    Session *session = sessionFor(sender());
+    if (session == NULL)
+        return;
+    session->errorMessage = message;
+    /* Failures before the transfer started (e.g. host lookup) don't end in done() */
+    if (!session->commandIssued)
+        finishSession(session, true);
+}
+
+void QTftpSessionManager::abort()
+{
+    while (!m_pending.isEmpty())
+        abort(m_pending.first()->id);
+    foreach (int id, m_active.keys())
+        abort(id);
+}
+
+void QTftpSessionManager::abort(int id)
+{
+    for (int i = 0; i < m_pending.size(); i++) {
+        if (m_pending.at(i)->id == id) {
+            Session *session = m_pending.takeAt(i);
+            m_batchError = true;
+            emit sessionFinished(id, true, tr("Operation aborted"));
+            delete session;
+            if (!hasPendingCommands())
+                emit done(m_batchError);
+            return;
+        }
+    }
+    Session *session = m_active.value(id, NULL);
+    if (session == NULL)
+        return;
+    if (session->commandIssued) {
+        /* Ends in sessionDone() */
+        session->tftp->abort();
+    } else {
+        session->errorMessage = tr("Operation aborted");
+        finishSession(session, true);
+    }
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * QTftpSessionManager runs many transfers at once, e.g. to flash a whole rack
+ * of devices. Every session is a QTftp object of its own, so it has its own
+ * socket (TID), state and retransmission timer. Sessions are queued and started
+ * as soon as less than maxConcurrentSessions() transfers are running.
+ *
+ */
+
+#ifndef QTFTPSESSIONMANAGER_H
+#define QTFTPSESSIONMANAGER_H
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include "qtftp.h"
+#include "qtftpdeviceprofile.h"
+
+#define TFTP_DEFAULT_CONCURRENT_SESSIONS 16
+
+class QTftpSessionManager : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QTftpSessionManager(QObject *parent = 0);
+    virtual ~QTftpSessionManager();
+
+    void setMaxConcurrentSessions(int count);
+    int maxConcurrentSessions() const {
+        return m_maxConcurrent;
+    }
+    /* Applied to every session started from now on, see QTftp */
+    void setBlockSize(quint16 size);
+    void setWindowSize(quint16 size);
+    void setRetransmitTimeout(int minimum, int maximum);
+    void setMaxRetries(int retries);
+    void setTimeoutInterval(int seconds);
+    void setArmedMode(int interval, int timeout = TFTP_DEFAULT_ARMED_TIMEOUT);
+    void setBlockWrap(quint16 block);
+    void setPacing(int burst, int gap, bool autoTune = false);
+    void setMulticast(bool enabled, const QNetworkInterface &iface = QNetworkInterface());
+    /*
+     * With verify, an upload is read back into a QTftpHashSink and has to
+     * match the hash of what was sent. With skipIdentical, the file is read
+     * first and the upload skipped if it matches the image already, streamed
+     * uploads always go out. Both need the device to serve what it was given.
+     */
+    void setVerification(bool verify, bool skipIdentical = false);
+    /*
+     * Start every session with the QTftpDeviceProfile of its host and update
+     * it when the transfer succeeded. If it fails with a profile, the profile
+     * is forgotten and the transfer repeated once with the defaults, unless
+     * it streamed from a sequential device.
+     */
+    void setDeviceProfiles(bool enabled);
+    /* For the sessions as well as for the aggregate reports */
+    void setProgressInterval(int interval);
+
+    /*
+     * Queue a transfer, the return value identifies the session in all signals.
+     * The device has to stay open until sessionFinished() was emitted for it.
+     */
+    int put(const QString &host, QIODevice *dev, const QString &file, quint16 port = 69);
+    /* All sessions uploading the same image share its mapping */
+    int put(const QString &host, const QTftpImage &image, const QString &file, quint16 port = 69);
+    int put(const QString &host, const QByteArray &data, const QString &file, quint16 port = 69);
+    int get(const QString &host, const QString &file, QIODevice *dev, quint16 port = 69);
+
+    int pendingSessions() const {
+        return m_pending.size();
+    }
+    int activeSessions() const {
+        return m_active.size();
+    }
+    bool hasPendingCommands() const {
+        return !m_pending.isEmpty() || !m_active.isEmpty();
+    }
+
+signals:
+    void sessionStarted(int id);
+    void sessionProgress(int id, qint64 done, qint64 total);
+    /* Emitted right before sessionFinished() */
+    void sessionStatistics(int id, const QTftpStatistics &statistics);
+    /* The device already had the image, emitted right before sessionFinished() */
+    void sessionSkipped(int id);
+    void sessionFinished(int id, bool error, const QString &message);
+    /* Sum over all sessions queued since the last done(), rate limited */
+    void dataTransferProgress(qint64 done, qint64 total);
+    void progress(const QTftpProgress &progress);
+    /* All queued sessions have finished, error is set if any of them failed */
+    void done(bool error);
+
+public slots:
+    void abort();
+    void abort(int id);
+
+private slots:
+    void startPendingSessions();
+    void continueSession(int id);
+    void sessionStateChanged(QTftp::State state);
+    void sessionTransferProgress(qint64 done, qint64 total);
+    void sessionDone(bool error);
+    void sessionError(QTftp::ErrorCode errorCode, const QString &message);
+
+private:
+    /* An upload with verification reads the file before and after it */
+    enum Phase {
+        PreCheck,
+        Transfer,
+        Verify
+    };
+    struct Session {
+        int id;
+        QString host;
+        quint16 port;
+        QTftp::Command command;
+        QString file;
+        QIODevice *device;
+        QTftpImage image;
+        QTftp *tftp;
+        /* Started with the profile of its host */
+        bool profiled;
+        Phase phase;
+        bool verify;
+        QTftpHashSink *sink;
+        QByteArray sourceHash;
+        /* Of the upload itself, the read back resets those of the QTftp */
+        QTftpStatistics statistics;
+        bool commandIssued;
+        qint64 done;
+        qint64 total;
+        QString errorMessage;
+    };
+
+    int enqueue(QTftp::Command command, const QString &host, quint16 port, const QString &file, QIODevice *dev,
+                const QTftpImage &image = QTftpImage());
+    void startSession(Session *session);
+    void configure(QTftp *tftp);
+    bool retryWithoutProfile(Session *session);
+    void issueCommand(Session *session);
+    void finishSession(Session *session, bool error);
+    void nextPhase(Session *session, Phase phase);
+    void readBackDone(Session *session, bool error);
+    void emitAggregateProgress(bool force = false);
+    Session *sessionFor(QObject *tftp) const;
+
+private:
+    int m_maxConcurrent;
+    int m_nextId;
+    quint16 m_blockSize;
+    quint16 m_windowSize;
+    int m_minRto;
+    int m_maxRto;
+    int m_maxRetries;
+    int m_timeoutInterval;
+    int m_armedInterval;
+    int m_armedTimeout;
+    quint16 m_blockWrap;
+    int m_pacingBurst;
+    int m_pacingGap;
+    bool m_pacingAutoTune;
+    bool m_multicast;
+    QNetworkInterface m_multicastInterface;
+    bool m_verify;
+    bool m_skipIdentical;
+    bool m_deviceProfiles;
+
+    QList<Session*> m_pending;
+    QMap<int, Session*> m_active;
+    QHash<QObject*, Session*> m_byTftp;
+
+    /* Aggregate progress and result of the current batch */
+    qint64 m_finishedDone;
+    qint64 m_finishedTotal;
+    int m_finishedRetransmissions;
+    QTftpProgressMeter m_meter;
+    bool m_batchError;
+};
+
+#endif // QTFTPSESSIONMANAGER_H
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftpstatistics.h"
+
+QTftpStatistics::QTftpStatistics()
+{
+    reset();
+}
+
+void QTftpStatistics::reset()
+{
+    packetsSent = 0;
+    packetsReceived = 0;
+    bytesSent = 0;
+    bytesReceived = 0;
+    payloadBytes = 0;
+    retransmissions = 0;
+    duplicates = 0;
+    rttSamples = 0;
+    for (int i = 0; i < TFTP_RTT_BUCKETS; i++)
+        rttHistogram[i] = 0;
+    for (int i = 0; i < TFTP_STATE_COUNT; i++)
+        timeInState[i] = 0;
+    goodput = 0;
+}
+
+int QTftpStatistics::rttBucket(qint64 rtt)
+{
+    int bucket = 0;
+    while (bucket < TFTP_RTT_BUCKETS-1 && rtt >= ((qint64) 1 << bucket))
+        bucket++;
+    return bucket;
+}
+
+void QTftpStatistics::addRttSample(qint64 rtt)
+{
+    if (rtt < 0)
+        return;
+    rttSamples++;
+    rttHistogram[rttBucket(rtt)]++;
+}
+
+qint64 QTftpStatistics::medianRtt() const
+{
+    if (rttSamples == 0)
+        return -1;
+    int seen = 0;
+    int bucket = 0;
+    for (; bucket < TFTP_RTT_BUCKETS-1; bucket++) {
+        seen += rttHistogram[bucket];
+        if (2*seen >= rttSamples)
+            break;
+    }
+    return (qint64) 1 << bucket;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Counters of one transfer, see QTftp::statistics(). They are meant to
+ * compare links: a site with many retransmissions, duplicates or a wide
+ * RTT histogram has a bad one.
+ *
+ */
+
+#ifndef QTFTPSTATISTICS_H
+#define QTFTPSTATISTICS_H
+#include <QtGlobal>
+#include <QMetaType>
+
+/* Bucket i counts RTT samples below 2^i ms, the last one all longer ones */
+#define TFTP_RTT_BUCKETS 14
+/* One entry per QTftp::State */
+#define TFTP_STATE_COUNT 6
+
+struct QTftpStatistics {
+    QTftpStatistics();
+    void reset();
+    void addRttSample(qint64 rtt);
+    static int rttBucket(qint64 rtt);
+    /* Upper bound of the bucket holding the median RTT sample, -1 without samples */
+    qint64 medianRtt() const;
+
+    /* Datagrams including TFTP headers, but without UDP/IP */
+    qint64 packetsSent;
+    qint64 packetsReceived;
+    qint64 bytesSent;
+    qint64 bytesReceived;
+    /* File content transferred, acknowledged blocks on uploads */
+    qint64 payloadBytes;
+    int retransmissions;
+    /* DATA blocks and ACKs that arrived again */
+    int duplicates;
+    int rttSamples;
+    int rttHistogram[TFTP_RTT_BUCKETS];
+    /* Time spent in each state in ms, indexed by QTftp::State */
+    qint64 timeInState[TFTP_STATE_COUNT];
+    /* Payload bytes per second spent Transfering */
+    double goodput;
+};
+
+Q_DECLARE_METATYPE(QTftpStatistics)
+
+#endif // QTFTPSTATISTICS_H
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftpthread.h"
+#include <QMetaType>
+
+QTftpWorker::QTftpWorker(QObject *parent) :
+    QObject(parent),
+    m_tftp(new QTftp(this)),
+    m_file(NULL),
+    m_command(NoCommand),
+    m_blockSize(m_tftp->requestedBlockSize()),
+    m_windowSize(m_tftp->requestedWindowSize()),
+    m_deviceProfiles(false),
+    m_profiled(false)
+{
+    connect(m_tftp, SIGNAL(stateChanged(QTftp::State)), this, SIGNAL(stateChanged(QTftp::State)));
+    connect(m_tftp, SIGNAL(dataTransferProgress(qint64,qint64)), this, SIGNAL(dataTransferProgress(qint64,qint64)));
+    connect(m_tftp, SIGNAL(progress(QTftpProgress)), this, SIGNAL(progress(QTftpProgress)));
+    /* Held back if the transfer is going to be repeated without the profile */
+    connect(m_tftp, SIGNAL(error(QTftp::ErrorCode,QString)), this, SLOT(transferError(QTftp::ErrorCode,QString)));
+    /* Close the file before anybody hears about the result */
+    connect(m_tftp, SIGNAL(done(bool)), this, SLOT(transferDone(bool)));
+}
+
+void QTftpWorker::setBlockSize(int size)
+{
+    m_tftp->setBlockSize(size);
+    m_blockSize = m_tftp->requestedBlockSize();
+}
+
+void QTftpWorker::setWindowSize(int size)
+{
+    m_tftp->setWindowSize(size);
+    m_windowSize = m_tftp->requestedWindowSize();
+}
+
+void QTftpWorker::setRetransmitTimeout(int minimum, int maximum)
+{
+    m_tftp->setRetransmitTimeout(minimum, maximum);
+}
+
+void QTftpWorker::setMaxRetries(int retries)
+{
+    m_tftp->setMaxRetries(retries);
+}
+
+void QTftpWorker::setTimeoutInterval(int seconds)
+{
+    m_tftp->setTimeoutInterval(seconds);
+}
+
+void QTftpWorker::setArmedMode(int interval, int timeout)
+{
+    m_tftp->setArmedMode(interval, timeout);
+}
+
+void QTftpWorker::setProgressInterval(int interval)
+{
+    m_tftp->setProgressInterval(interval);
+}
+
+void QTftpWorker::setDeviceProfiles(bool enabled)
+{
+    m_deviceProfiles = enabled;
+}
+
+void QTftpWorker::connectToHost(const QString &host, int port)
+{
+    m_host = host;
+    m_tftp->connectToHost(host, port);
+}
+
+void QTftpWorker::disconnectFromHost()
+{
+    m_tftp->disconnectFromHost();
+}
+
+void QTftpWorker::putFile(const QString &fileName, const QString &remoteFile)
+{
+    m_command = PutFile;
+    m_localFile = fileName;
+    m_remoteFile = remoteFile;
+    m_data.clear();
+    startCommand();
+}
+
+void QTftpWorker::putData(const QByteArray &data, const QString &remoteFile)
+{
+    m_command = PutData;
+    m_localFile.clear();
+    m_remoteFile = remoteFile;
+    m_data = data;
+    startCommand();
+}
+
+void QTftpWorker::getFile(const QString &remoteFile, const QString &fileName)
+{
+    m_command = GetFile;
+    m_localFile = fileName;
+    m_remoteFile = remoteFile;
+    m_data.clear();
+    startCommand();
+}
+
+void QTftpWorker::startCommand()
+{
+    m_tftp->setBlockSize(m_blockSize);
+    m_tftp->setWindowSize(m_windowSize);
+    m_tftp->setInitialRetransmitTimeout(0);
+    m_profiled = false;
+    if (m_deviceProfiles) {
+        const QTftpDeviceProfile profile = QTftpDeviceProfile::load(m_host);
+        profile.apply(m_tftp);
+        m_profiled = profile.isValid();
+    }
+    int result = -1;
+    if (m_command == PutFile) {
+        QTftpImage image = QTftpImage::map(m_localFile);
+        if (image.isNull()) {
+            fail(tr("Unable to open ") + m_localFile);
+            return;
+        }
+        result = m_tftp->put(image, m_remoteFile);
+    } else if (m_command == PutData) {
+        result = m_tftp->put(m_data, m_remoteFile);
+    } else if (m_command == GetFile) {
+        delete m_file;
+        m_file = new QFile(m_localFile);
+        /* ReadWrite lets QTftp map the file once it knows the size */
+        if (!m_file->open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+            delete m_file;
+            m_file = NULL;
+            fail(tr("Unable to open ") + m_localFile);
+            return;
+        }
+        result = m_tftp->get(m_remoteFile, m_file);
+    }
+    /* QTftp reports why it refused a command through error() itself */
+    if (result != 0)
+        transferDone(true);
+}
+
+void QTftpWorker::abort()
+{
+    m_tftp->abort();
+}
+
+bool QTftpWorker::retryWithoutProfile()
+{
+    if (!m_profiled || m_command == NoCommand || m_tftp->getLastErrorCode() == QTftp::AbortedByUser)
+        return false;
+    QTftpDeviceProfile::forget(m_host);
+    m_profiled = false;
+    return true;
+}
+
+void QTftpWorker::transferError(QTftp::ErrorCode errorCode, const QString &message)
+{
+    /* A failure with a profile is repeated without it, see transferDone() */
+    if (m_profiled && errorCode != QTftp::AbortedByUser)
+        return;
+    emit error(errorCode, message);
+}
+
+void QTftpWorker::transferDone(bool error)
+{
+    if (error && retryWithoutProfile()) {
+        /* Not from within done(), the QTftp still handles the datagram that ended the transfer */
+        QMetaObject::invokeMethod(this, "startCommand", Qt::QueuedConnection);
+        return;
+    }
+    if (!error && m_deviceProfiles)
+        QTftpDeviceProfile::load(m_host).learn(m_tftp).save(m_host);
+    m_profiled = false;
+    if (m_file != NULL) {
+        m_file->close();
+        delete m_file;
+        m_file = NULL;
+    }
+    emit statistics(m_tftp->statistics());
+    emit done(error);
+}
+
+void QTftpWorker::fail(const QString &message)
+{
+    /* Nothing the device could have caused */
+    m_profiled = false;
+    emit error(QTftp::UnknownError, message);
+    transferDone(true);
+}
+
+QTftpThread::QTftpThread(QObject *parent) :
+    QObject(parent),
+    m_worker(new QTftpWorker),
+    m_state(QTftp::Idle)
+{
+    /* The signals cross threads, so their arguments have to be queued */
+    qRegisterMetaType<QTftp::State>("QTftp::State");
+    qRegisterMetaType<QTftp::ErrorCode>("QTftp::ErrorCode");
+    qRegisterMetaType<QTftpProgress>("QTftpProgress");
+    qRegisterMetaType<QTftpStatistics>("QTftpStatistics");
+
+    m_worker->moveToThread(&m_thread);
+    connect(&m_thread, SIGNAL(finished()), m_worker, SLOT(deleteLater()));
+    connect(m_worker, SIGNAL(stateChanged(QTftp::State)), this, SLOT(updateState(QTftp::State)));
+    connect(m_worker, SIGNAL(dataTransferProgress(qint64,qint64)), this, SIGNAL(dataTransferProgress(qint64,qint64)));
+    connect(m_worker, SIGNAL(progress(QTftpProgress)), this, SIGNAL(progress(QTftpProgress)));
+    connect(m_worker, SIGNAL(statistics(QTftpStatistics)), this, SIGNAL(statistics(QTftpStatistics)));
+    connect(m_worker, SIGNAL(done(bool)), this, SIGNAL(done(bool)));
+    connect(m_worker, SIGNAL(error(QTftp::ErrorCode,QString)), this, SIGNAL(error(QTftp::ErrorCode,QString)));
+    m_thread.setObjectName("QTftp");
+    m_thread.start();
+}
+
+QTftpThread::~QTftpThread()
+{
+    /* The worker is deleted on its own thread once the event loop is left */
+    m_thread.quit();
+    m_thread.wait();
+}
+
+void QTftpThread::setBlockSize(quint16 size)
+{
+    QMetaObject::invokeMethod(m_worker, "setBlockSize", Qt::QueuedConnection, Q_ARG(int, size));
+}
+
+void QTftpThread::setWindowSize(quint16 size)
+{
+    QMetaObject::invokeMethod(m_worker, "setWindowSize", Qt::QueuedConnection, Q_ARG(int, size));
+}
+
+void QTftpThread::setRetransmitTimeout(int minimum, int maximum)
+{
+    QMetaObject::invokeMethod(m_worker, "setRetransmitTimeout", Qt::QueuedConnection,
+                              Q_ARG(int, minimum), Q_ARG(int, maximum));
+}
+
+void QTftpThread::setMaxRetries(int retries)
+{
+    QMetaObject::invokeMethod(m_worker, "setMaxRetries", Qt::QueuedConnection, Q_ARG(int, retries));
+}
+
+void QTftpThread::setTimeoutInterval(int seconds)
+{
+    QMetaObject::invokeMethod(m_worker, "setTimeoutInterval", Qt::QueuedConnection, Q_ARG(int, seconds));
+}
+
+void QTftpThread::setArmedMode(int interval, int timeout)
+{
+    QMetaObject::invokeMethod(m_worker, "setArmedMode", Qt::QueuedConnection,
+                              Q_ARG(int, interval), Q_ARG(int, timeout));
+}
+
+void QTftpThread::setProgressInterval(int interval)
+{
+    QMetaObject::invokeMethod(m_worker, "setProgressInterval", Qt::QueuedConnection, Q_ARG(int, interval));
+}
+
+void QTftpThread::setDeviceProfiles(bool enabled)
+{
+    QMetaObject::invokeMethod(m_worker, "setDeviceProfiles", Qt::QueuedConnection, Q_ARG(bool, enabled));
+}
+
+void QTftpThread::connectToHost(const QString &host, quint16 port)
+{
+    QMetaObject::invokeMethod(m_worker, "connectToHost", Qt::QueuedConnection,
+                              Q_ARG(QString, host), Q_ARG(int, port));
+}
+
+void QTftpThread::disconnectFromHost()
+{
+    QMetaObject::invokeMethod(m_worker, "disconnectFromHost", Qt::QueuedConnection);
+}
+
+void QTftpThread::putFile(const QString &fileName, const QString &remoteFile)
+{
+    QMetaObject::invokeMethod(m_worker, "putFile", Qt::QueuedConnection,
+                              Q_ARG(QString, fileName), Q_ARG(QString, remoteFile));
+}
+
+void QTftpThread::putData(const QByteArray &data, const QString &remoteFile)
+{
+    QMetaObject::invokeMethod(m_worker, "putData", Qt::QueuedConnection,
+                              Q_ARG(QByteArray, data), Q_ARG(QString, remoteFile));
+}
+
+void QTftpThread::getFile(const QString &remoteFile, const QString &fileName)
+{
+    QMetaObject::invokeMethod(m_worker, "getFile", Qt::QueuedConnection,
+                              Q_ARG(QString, remoteFile), Q_ARG(QString, fileName));
+}
+
+void QTftpThread::abort()
+{
+    QMetaObject::invokeMethod(m_worker, "abort", Qt::QueuedConnection);
+}
+
+void QTftpThread::updateState(QTftp::State state)
+{
+    m_state = state;
+    emit stateChanged(state);
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * QTftpThread runs a QTftp on a thread of its own, so answering an ACK with
+ * the next DATA block never waits for the GUI to repaint or for a modal
+ * dialog. Every method may be called from any thread, the call is queued to
+ * the worker. The signals are those of QTftp and arrive in the thread
+ * QTftpThread lives in. Files are opened by the worker, so callers never
+ * share a QIODevice with it.
+ *
+ */
+
+#ifndef QTFTPTHREAD_H
+#define QTFTPTHREAD_H
+#include <QObject>
+#include <QThread>
+#include "qtftp.h"
+#include "qtftpdeviceprofile.h"
+
+/* Lives in the worker thread and owns the QTftp and the file being transferred */
+class QTftpWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QTftpWorker(QObject *parent = 0);
+
+public slots:
+    void setBlockSize(int size);
+    void setWindowSize(int size);
+    void setRetransmitTimeout(int minimum, int maximum);
+    void setMaxRetries(int retries);
+    void setTimeoutInterval(int seconds);
+    void setArmedMode(int interval, int timeout);
+    void setProgressInterval(int interval);
+    void setDeviceProfiles(bool enabled);
+    void connectToHost(const QString &host, int port);
+    void disconnectFromHost();
+    void putFile(const QString &fileName, const QString &remoteFile);
+    void putData(const QByteArray &data, const QString &remoteFile);
+    void getFile(const QString &remoteFile, const QString &fileName);
+    void abort();
+
+signals:
+    void stateChanged(QTftp::State state);
+    void dataTransferProgress(qint64 done, qint64 total);
+    void progress(const QTftpProgress &progress);
+    /* Counters of the finished transfer, emitted right before done() */
+    void statistics(const QTftpStatistics &statistics);
+    void done(bool error);
+    void error(QTftp::ErrorCode, const QString&);
+
+private slots:
+    void transferError(QTftp::ErrorCode errorCode, const QString &message);
+    void transferDone(bool error);
+    void startCommand();
+
+private:
+    enum Command {
+        NoCommand,
+        PutFile,
+        PutData,
+        GetFile
+    };
+    void fail(const QString &message);
+    bool retryWithoutProfile();
+
+    QTftp *m_tftp;
+    QFile *m_file;
+    /* The last command, kept to repeat it without the device profile */
+    Command m_command;
+    QString m_localFile;
+    QString m_remoteFile;
+    QByteArray m_data;
+    /* Requested without a profile, see QTftpDeviceProfile::apply() */
+    quint16 m_blockSize;
+    quint16 m_windowSize;
+    QString m_host;
+    bool m_deviceProfiles;
+    bool m_profiled;
+};
+
+class QTftpThread : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QTftpThread(QObject *parent = 0);
+    virtual ~QTftpThread();
+
+    /* See QTftp, applied to the next request */
+    void setBlockSize(quint16 size);
+    void setWindowSize(quint16 size);
+    void setRetransmitTimeout(int minimum, int maximum);
+    void setMaxRetries(int retries);
+    void setTimeoutInterval(int seconds);
+    void setArmedMode(int interval, int timeout = TFTP_DEFAULT_ARMED_TIMEOUT);
+    void setProgressInterval(int interval);
+    /*
+     * Start with the QTftpDeviceProfile of the host and update it after every
+     * successful transfer. A transfer that fails with a profile forgets it
+     * and is repeated once with the defaults.
+     */
+    void setDeviceProfiles(bool enabled);
+
+    void connectToHost(const QString &host, quint16 port = 69);
+    void disconnectFromHost();
+    /* Uploads a local file, it is mapped by the worker */
+    void putFile(const QString &fileName, const QString &remoteFile);
+    void putData(const QByteArray &data, const QString &remoteFile);
+    /* Downloads into a local file, which is replaced */
+    void getFile(const QString &remoteFile, const QString &fileName);
+
+    /* Last state reported by the worker */
+    QTftp::State state() const {
+        return m_state;
+    }
+
+signals:
+    void stateChanged(QTftp::State state);
+    void dataTransferProgress(qint64 done, qint64 total);
+    void progress(const QTftpProgress &progress);
+    /* Counters of the finished transfer, emitted right before done() */
+    void statistics(const QTftpStatistics &statistics);
+    void done(bool error);
+    void error(QTftp::ErrorCode, const QString&);
+
+public slots:
+    void abort();
+
+private slots:
+    void updateState(QTftp::State state);
+
+private:
+    QThread m_thread;
+    QTftpWorker *m_worker;
+    QTftp::State m_state;
+};
+
+#endif // QTFTPTHREAD_H
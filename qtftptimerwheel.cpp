@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qtftptimerwheel.h"
+#include <QThreadStorage>
+
+/* One wheel per thread, as the tick timer has to live in the thread of the sessions */
+static QThreadStorage<QTftpTimerWheel *> wheels;
+
+QTftpWheelTimer::QTftpWheelTimer(QObject *parent) :
+    QObject(parent),
+    m_wheel(NULL),
+    m_previous(NULL),
+    m_next(NULL),
+    m_slot(0),
+    m_rounds(0),
+    m_interval(0)
+{
+}
+
+QTftpWheelTimer::~QTftpWheelTimer()
+{
+    stop();
+}
+
+void QTftpWheelTimer::start(int msec)
+{
+    stop();
+    m_interval = msec;
+    QTftpTimerWheel::instance()->arm(this, msec);
+}
+
+void QTftpWheelTimer::stop()
+{
+    if (m_wheel != NULL)
+        m_wheel->cancel(this);
+}
+
+QTftpTimerWheel *QTftpTimerWheel::instance()
+{
+    if (!wheels.hasLocalData())
+        wheels.setLocalData(new QTftpTimerWheel);
+    return wheels.localData();
+}
+
+QTftpTimerWheel::QTftpTimerWheel() :
+    m_expired(NULL),
+    m_tick(0),
+    m_armed(0),
+    m_tickTimer(new QTimer(this))
+{
+    for (int i = 0; i < TFTP_WHEEL_SLOTS; i++)
+        m_slots[i] = NULL;
+    m_clock.start();
+    connect(m_tickTimer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+QTftpTimerWheel::~QTftpTimerWheel()
+{
+    /* Timers outliving their thread's wheel are simply no longer armed */
+    for (int i = -1; i < TFTP_WHEEL_SLOTS; i++) {
+        while (*list(i) != NULL)
+            cancel(*list(i));
+    }
+}
+
+void QTftpTimerWheel::arm(QTftpWheelTimer *timer, int msec)
+{
+    if (m_armed++ == 0) {
+        /* Nothing to catch up with after being idle */
+        m_tick = m_clock.elapsed() / TFTP_WHEEL_TICK;
+        m_tickTimer->start(TFTP_WHEEL_TICK);
+    }
+    /* Rounded up, a deadline may fire late but never early */
+    const qint64 due = qMax(m_tick + 1, (m_clock.elapsed() + qMax(0, msec) + TFTP_WHEEL_TICK - 1) / TFTP_WHEEL_TICK);
+    timer->m_wheel = this;
+    timer->m_slot = due % TFTP_WHEEL_SLOTS;
+    timer->m_rounds = (due - m_tick - 1) / TFTP_WHEEL_SLOTS;
+    link(list(timer->m_slot), timer);
+}
+
+void QTftpTimerWheel::cancel(QTftpWheelTimer *timer)
+{
+    if (timer->m_wheel != this)
+        return;
+    unlink(list(timer->m_slot), timer);
+    timer->m_wheel = NULL;
+    if (--m_armed == 0)
+        m_tickTimer->stop();
+}
+
+void QTftpTimerWheel::link(QTftpWheelTimer **list, QTftpWheelTimer *timer)
+{
+    timer->m_previous = NULL;
+    timer->m_next = *list;
+    if (*list != NULL)
+        (*list)->m_previous = timer;
+    *list = timer;
+}
+
+void QTftpTimerWheel::unlink(QTftpWheelTimer **list, QTftpWheelTimer *timer)
+{
+    if (timer->m_previous != NULL)
+        timer->m_previous->m_next = timer->m_next;
+    else
+        *list = timer->m_next;
+    if (timer->m_next != NULL)
+        timer->m_next->m_previous = timer->m_previous;
+    timer->m_previous = NULL;
+    timer->m_next = NULL;
+}
+
+void QTftpTimerWheel::tick()
+{
+    /* A busy event loop may have skipped ticks, every slot passed is visited */
+    const qint64 now = m_clock.elapsed() / TFTP_WHEEL_TICK;
+    while (m_tick < now && m_armed > 0) {
+        m_tick++;
+        QTftpWheelTimer **slot = list(m_tick % TFTP_WHEEL_SLOTS);
+        QTftpWheelTimer *timer = *slot;
+        while (timer != NULL) {
+            QTftpWheelTimer *next = timer->m_next;
+            if (timer->m_rounds > 0) {
+                timer->m_rounds--;
+            } else {
+                unlink(slot, timer);
+                timer->m_slot = -1;
+                link(&m_expired, timer);
+            }
+            timer = next;
+        }
+        /*
+         * A timeout() may stop, restart or delete any timer, including the
+         * expired ones still waiting, which unlinks them from m_expired.
+         */
+        while (m_expired != NULL) {
+            QTftpWheelTimer *expired = m_expired;
+            cancel(expired);
+            emit expired->timeout();
+        }
+    }
+    if (m_armed == 0)
+        m_tick = now;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Retransmission deadlines of all sessions of a thread on one hashed timer
+ * wheel. A QTftpWheelTimer looks like a single shot QTimer to its owner,
+ * but arming and cancelling it only links it into or out of a slot of the
+ * wheel, O(1) and without the event dispatcher. A single coarse tick
+ * timer, running only while something is armed, advances the wheel and
+ * fires what is due. Deadlines are rounded up to the next tick and never
+ * fire early. Deadlines further away than one turn of the wheel count down
+ * their rounds in their slot.
+ *
+ */
+
+#ifndef QTFTPTIMERWHEEL_H
+#define QTFTPTIMERWHEEL_H
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+
+/* Granularity of the wheel in ms, well below TFTP_MIN_RTO */
+#define TFTP_WHEEL_TICK 5
+/* Slots of the wheel, a power of two, one turn covers 2.56 s */
+#define TFTP_WHEEL_SLOTS 512
+
+class QTftpTimerWheel;
+
+class QTftpWheelTimer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QTftpWheelTimer(QObject *parent = 0);
+    ~QTftpWheelTimer();
+
+    /* Fires timeout() once after msec, restarting it if it is armed already */
+    void start(int msec);
+    void stop();
+    bool isActive() const {
+        return m_wheel != NULL;
+    }
+    int interval() const {
+        return m_interval;
+    }
+
+signals:
+    void timeout();
+
+private:
+    friend class QTftpTimerWheel;
+    /* The wheel of the thread that armed it, NULL while not armed */
+    QTftpTimerWheel *m_wheel;
+    QTftpWheelTimer *m_previous;
+    QTftpWheelTimer *m_next;
+    /* -1 while it waits in the list of expired timers */
+    int m_slot;
+    int m_rounds;
+    int m_interval;
+};
+
+class QTftpTimerWheel : public QObject
+{
+    Q_OBJECT
+public:
+    /* The wheel of the calling thread, created on first use */
+    static QTftpTimerWheel *instance();
+    ~QTftpTimerWheel();
+
+    void arm(QTftpWheelTimer *timer, int msec);
+    void cancel(QTftpWheelTimer *timer);
+    int armedCount() const {
+        return m_armed;
+    }
+
+private slots:
+    void tick();
+
+private:
+    QTftpTimerWheel();
+    Q_DISABLE_COPY(QTftpTimerWheel)
+
+    void link(QTftpWheelTimer **list, QTftpWheelTimer *timer);
+    void unlink(QTftpWheelTimer **list, QTftpWheelTimer *timer);
+    QTftpWheelTimer **list(int slot) {
+        return slot < 0 ? &m_expired : &m_slots[slot];
+    }
+
+    QTftpWheelTimer *m_slots[TFTP_WHEEL_SLOTS];
+    /* Due in the tick being processed, their timeout() is still to be emitted */
+    QTftpWheelTimer *m_expired;
+    /* Ticks since m_clock started that have been processed */
+    qint64 m_tick;
+    int m_armed;
+    QElapsedTimer m_clock;
+    QTimer *m_tickTimer;
+};
+
+#endif // QTFTPTIMERWHEEL_H
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Unit tests and microbenchmarks of the packet
+# codec, run with make check
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_qtftppacket
+TEMPLATE = app
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+INCLUDEPATH += ..
+DEPENDPATH += ..
+
+SOURCES += tst_qtftppacket.cpp \
+    ../qtftppacket.cpp
+
+HEADERS  += ../qtftppacket.h
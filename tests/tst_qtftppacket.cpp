@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2012 by Maximilian Güntner <maximilian.guentner@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Tests of QTftpPacket. The benchmarks time single packets with
+ * QBENCHMARK, the malformed and fuzz tests make sure that every view a
+ * parser hands out stays inside the datagram. Datagrams are allocated with
+ * their exact size, so that a build with -fsanitize=address catches any
+ * read past them. The block number tests cover both wraps at 65535 and
+ * windows across it.
+ *
+ */
+
+#include <QtTest>
+#include <QByteArray>
+#include <stdlib.h>
+#include <string.h>
+#include "qtftppacket.h"
+
+/* Random datagrams of fuzz() */
+#define TFTP_FUZZ_ROUNDS 100000
+
+static QByteArray packet(quint16 opCode, const QByteArray &body)
+{
+    QByteArray data;
+    data.append((char) (opCode >> 8)).append((char) opCode);
+    return data.append(body);
+}
+
+class QTftpPacketTest : public QObject
+{
+    Q_OBJECT
+public:
+    QTftpPacketTest();
+
+private slots:
+    void buildRequest();
+    void buildAcknowledgment();
+    void buildError();
+    void parseData();
+    void parseAcknowledgment();
+    void parseRequest();
+    void parseOptionAcknowledgment();
+    void malformed_data();
+    void malformed();
+    void fuzz();
+    void wireBlock_data();
+    void wireBlock();
+    void blockFromWire_data();
+    void blockFromWire();
+    void windowAcrossWrap_data();
+    void windowAcrossWrap();
+
+private:
+    static bool parsesInside(const QByteArray &datagram);
+    static bool check(const char *packet, int size);
+
+    QList<QByteArray> m_corpus;
+    char m_buffer[TFTP_MAX_REQUEST_SIZE];
+};
+
+QTftpPacketTest::QTftpPacketTest()
+{
+    QByteArray block(1428, 'x');
+    m_corpus.append(packet(QTftpPacket::Data, QByteArray("\x12\x34", 2) + block));
+    m_corpus.append(packet(QTftpPacket::Acknowledgment, QByteArray("\x12\x34", 2)));
+    m_corpus.append(packet(QTftpPacket::ReadRequest,
+                           QByteArray("ethersex.bin\0octet\0blksize\0001428\0windowsize\00016\0tsize\0000\0multicast\0\0", 65)));
+    m_corpus.append(packet(QTftpPacket::OptionAcknowledgment,
+                           QByteArray("blksize\0001428\0windowsize\00016\0tsize\000123456\0", 40)));
+    /* Not terminated, as some devices send it */
+    m_corpus.append(packet(QTftpPacket::Error, QByteArray("\0\1File not found", 16)));
+}
+
+void QTftpPacketTest::buildRequest()
+{
+    const QString file("ethersex.bin");
+    int size = 0;
+    QBENCHMARK {
+        size = QTftpPacket::writeRequest(m_buffer, sizeof(m_buffer), QTftpPacket::WriteRequest, file, "octet");
+        size = QTftpPacket::appendOption(m_buffer, sizeof(m_buffer), size, "blksize", 1428);
+        size = QTftpPacket::appendOption(m_buffer, sizeof(m_buffer), size, "windowsize", 16);
+        size = QTftpPacket::appendOption(m_buffer, sizeof(m_buffer), size, "tsize", 123456);
+    }
+    QCOMPARE(QByteArray(m_buffer, size),
+             packet(QTftpPacket::WriteRequest, QByteArray("ethersex.bin\0octet\0blksize\0001428\0windowsize\00016\0tsize\000123456\0", 59)));
+    /* Too small a buffer is refused instead of overrun */
+    QCOMPARE(QTftpPacket::writeRequest(m_buffer, 10, QTftpPacket::WriteRequest, file, "octet"), -1);
+    QCOMPARE(QTftpPacket::appendOption(m_buffer, size + 8, size, "blksize", 1428), -1);
+}
+
+void QTftpPacketTest::buildAcknowledgment()
+{
+    int size = 0;
+    QBENCHMARK {
+        size = QTftpPacket::writeAcknowledgment(m_buffer, 0x1234);
+    }
+    QCOMPARE(QByteArray(m_buffer, size), m_corpus.at(1));
+}
+
+void QTftpPacketTest::buildError()
+{
+    const QString message("Unknown transfer ID");
+    int size = 0;
+    QBENCHMARK {
+        size = QTftpPacket::writeError(m_buffer, sizeof(m_buffer), 5, message);
+    }
+    QCOMPARE(QByteArray(m_buffer, size), packet(QTftpPacket::Error, QByteArray("\0\5Unknown transfer ID\0", 22)));
+    /* A message that doesn't fit is cut short and still terminated */
+    size = QTftpPacket::writeError(m_buffer, 10, 5, message);
+    QCOMPARE(QByteArray(m_buffer, size), packet(QTftpPacket::Error, QByteArray("\0\5Unkno\0", 8)));
+}
+
+void QTftpPacketTest::parseData()
+{
+    const QByteArray &data = m_corpus.at(0);
+    quint16 block = 0;
+    const char *payload = NULL;
+    int size = 0;
+    bool parsed = false;
+    QBENCHMARK {
+        parsed = QTftpPacket::parseData(data.constData(), data.size(), &block, &payload, &size);
+    }
+    QVERIFY(parsed);
+    QCOMPARE(block, (quint16) 0x1234);
+    QVERIFY(payload == data.constData() + TFTP_HEADER_SIZE);
+    QCOMPARE(size, 1428);
+}
+
+void QTftpPacketTest::parseAcknowledgment()
+{
+    const QByteArray &data = m_corpus.at(1);
+    quint16 block = 0;
+    bool parsed = false;
+    QBENCHMARK {
+        parsed = QTftpPacket::parseAcknowledgment(data.constData(), data.size(), &block);
+    }
+    QVERIFY(parsed);
+    QCOMPARE(block, (quint16) 0x1234);
+    QVERIFY(!QTftpPacket::parseAcknowledgment(data.constData(), 3, &block));
+}
+
+void QTftpPacketTest::parseRequest()
+{
+    const QByteArray &data = m_corpus.at(2);
+    QTftpPacketString file;
+    QTftpPacketString mode;
+    QTftpPacketString name;
+    QTftpPacketString value;
+    int options = 0;
+    quint64 blockSize = 0;
+    QBENCHMARK {
+        int offset = 0;
+        options = -1;
+        if (QTftpPacket::parseRequest(data.constData(), data.size(), &file, &mode, &offset))
+            options = 0;
+        while (options >= 0 && QTftpPacket::nextOption(data.constData(), data.size(), &offset, &name, &value)) {
+            options++;
+            if (name.equals("blksize"))
+                value.toNumber(65464, &blockSize);
+        }
+    }
+    QCOMPARE(file.toString(), QString("ethersex.bin"));
+    QVERIFY(mode.equals("octet"));
+    QCOMPARE(options, 4);
+    QCOMPARE(blockSize, Q_UINT64_C(1428));
+    /* The multicast option of a request has an empty value */
+    QVERIFY(name.equals("multicast"));
+    QCOMPARE(value.size, 0);
+}
+
+void QTftpPacketTest::parseOptionAcknowledgment()
+{
+    const QByteArray &data = m_corpus.at(3);
+    QTftpPacketString name;
+    QTftpPacketString value;
+    quint64 sum = 0;
+    QBENCHMARK {
+        int offset = 2;
+        sum = 0;
+        while (QTftpPacket::nextOption(data.constData(), data.size(), &offset, &name, &value)) {
+            quint64 number;
+            if (value.toNumber(Q_UINT64_C(0xffffffffffffffff), &number))
+                sum += number;
+        }
+    }
+    QCOMPARE(sum, Q_UINT64_C(1428 + 16 + 123456));
+    quint64 number;
+    /* Out of range and not a number */
+    QTftpPacketString text = { "18446744073709551616", 20 };
+    QVERIFY(!text.toNumber(Q_UINT64_C(0xffffffffffffffff), &number));
+    text.data = "12a";
+    text.size = 3;
+    QVERIFY(!text.toNumber(100, &number));
+    /* Maxima below ten, as with the default requested window of 8 */
+    text.data = "9";
+    text.size = 1;
+    QVERIFY(!text.toNumber(8, &number));
+    text.data = "8";
+    QVERIFY(text.toNumber(8, &number));
+    QCOMPARE(number, Q_UINT64_C(8));
+    text.data = "5";
+    QVERIFY(!text.toNumber(1, &number));
+    text.data = "0";
+    QVERIFY(text.toNumber(0, &number));
+    text.data = "10";
+    text.size = 2;
+    QVERIFY(!text.toNumber(9, &number));
+    QVERIFY(text.toNumber(10, &number));
+    text.data = "18446744073709551615";
+    text.size = 20;
+    QVERIFY(text.toNumber(Q_UINT64_C(0xffffffffffffffff), &number));
+    QCOMPARE(number, Q_UINT64_C(0xffffffffffffffff));
+}
+
+void QTftpPacketTest::malformed_data()
+{
+    QTest::addColumn<QByteArray>("datagram");
+    QTest::newRow("empty") << QByteArray();
+    QTest::newRow("opcode only") << packet(QTftpPacket::Data, QByteArray());
+    QTest::newRow("short header") << packet(QTftpPacket::Acknowledgment, QByteArray("\0", 1));
+    QTest::newRow("unterminated file") << packet(QTftpPacket::ReadRequest, QByteArray("ethersex.bin"));
+    QTest::newRow("empty file") << packet(QTftpPacket::ReadRequest, QByteArray("\0octet\0", 7));
+    QTest::newRow("unterminated mode") << packet(QTftpPacket::ReadRequest, QByteArray("a\0octet", 7));
+    QTest::newRow("option without value") << packet(QTftpPacket::ReadRequest, QByteArray("a\0octet\0blksize\0", 16));
+    QTest::newRow("unterminated value") << packet(QTftpPacket::OptionAcknowledgment, QByteArray("blksize\0001428", 12));
+    QTest::newRow("unterminated error") << packet(QTftpPacket::Error, QByteArray("\0\1x", 3));
+    QTest::newRow("unknown opcode") << packet(0x1234, QByteArray("\0\1", 2));
+    /* Every prefix of the corpus, which cuts each field at every position */
+    for (int i = 0; i < m_corpus.size(); i++) {
+        const QByteArray &data = m_corpus.at(i);
+        for (int length = 0; length < qMin(data.size(), 80); length++)
+            QTest::newRow(qPrintable(QString("corpus %1 cut at %2").arg(i).arg(length))) << data.left(length);
+    }
+}
+
+void QTftpPacketTest::malformed()
+{
+    QFETCH(QByteArray, datagram);
+    QVERIFY(parsesInside(datagram));
+}
+
+void QTftpPacketTest::fuzz()
+{
+    qsrand(1);
+    for (int round = 0; round < TFTP_FUZZ_ROUNDS; round++) {
+        QByteArray data;
+        const int kind = qrand() % 4;
+        if (kind == 0) {
+            /* Random bytes behind a valid opcode */
+            data = packet(1 + qrand() % 6, QByteArray());
+            const int length = qrand() % 64;
+            for (int i = 0; i < length; i++)
+                data.append((char) qrand());
+        } else {
+            data = m_corpus.at(qrand() % m_corpus.size());
+            if (kind == 1 || kind == 3)
+                data.truncate(qrand() % (data.size() + 1));
+            if (kind == 2 || kind == 3) {
+                const int flips = 1 + qrand() % 4;
+                for (int i = 0; i < flips && !data.isEmpty(); i++)
+                    data[qrand() % data.size()] = (char) qrand();
+            }
+        }
+        if (!parsesInside(data))
+            QFAIL(qPrintable(QString("round %1: %2").arg(round).arg(QString::fromLatin1(data.toHex()))));
+    }
+}
+
+void QTftpPacketTest::wireBlock_data()
+{
+    QTest::addColumn<quint16>("wrap");
+    QTest::addColumn<qint64>("block");
+    QTest::addColumn<quint16>("wire");
+    QTest::newRow("wrap 0, request") << (quint16) 0 << Q_INT64_C(0) << (quint16) 0;
+    QTest::newRow("wrap 0, first") << (quint16) 0 << Q_INT64_C(1) << (quint16) 1;
+    QTest::newRow("wrap 0, 65535") << (quint16) 0 << Q_INT64_C(65535) << (quint16) 65535;
+    QTest::newRow("wrap 0, 65536") << (quint16) 0 << Q_INT64_C(65536) << (quint16) 0;
+    QTest::newRow("wrap 0, 65537") << (quint16) 0 << Q_INT64_C(65537) << (quint16) 1;
+    QTest::newRow("wrap 0, second cycle") << (quint16) 0 << Q_INT64_C(131072) << (quint16) 0;
+    QTest::newRow("wrap 1, request") << (quint16) 1 << Q_INT64_C(0) << (quint16) 0;
+    QTest::newRow("wrap 1, first") << (quint16) 1 << Q_INT64_C(1) << (quint16) 1;
+    QTest::newRow("wrap 1, 65535") << (quint16) 1 << Q_INT64_C(65535) << (quint16) 65535;
+    QTest::newRow("wrap 1, 65536") << (quint16) 1 << Q_INT64_C(65536) << (quint16) 1;
+    QTest::newRow("wrap 1, 65537") << (quint16) 1 << Q_INT64_C(65537) << (quint16) 2;
+    /* 65535 blocks per cycle, 0 is never reused */
+    QTest::newRow("wrap 1, end of second cycle") << (quint16) 1 << Q_INT64_C(131070) << (quint16) 65535;
+    QTest::newRow("wrap 1, second cycle") << (quint16) 1 << Q_INT64_C(131071) << (quint16) 1;
+}
+
+void QTftpPacketTest::wireBlock()
+{
+    QFETCH(quint16, wrap);
+    QFETCH(qint64, block);
+    QFETCH(quint16, wire);
+    QCOMPARE(QTftpPacket::wireBlock(block, wrap), wire);
+}
+
+void QTftpPacketTest::blockFromWire_data()
+{
+    QTest::addColumn<quint16>("wrap");
+    QTest::addColumn<quint16>("wire");
+    QTest::addColumn<qint64>("reference");
+    QTest::addColumn<qint64>("block");
+    QTest::newRow("wrap 0, next after 65535") << (quint16) 0 << (quint16) 0 << Q_INT64_C(65535) << Q_INT64_C(65536);
+    QTest::newRow("wrap 0, previous before 65536") << (quint16) 0 << (quint16) 65535 << Q_INT64_C(65536) << Q_INT64_C(65535);
+    QTest::newRow("wrap 0, ahead across") << (quint16) 0 << (quint16) 1 << Q_INT64_C(65530) << Q_INT64_C(65537);
+    QTest::newRow("wrap 0, third cycle") << (quint16) 0 << (quint16) 5 << Q_INT64_C(131070) << Q_INT64_C(131077);
+    QTest::newRow("wrap 0, before the first") << (quint16) 0 << (quint16) 65534 << Q_INT64_C(1) << Q_INT64_C(-2);
+    QTest::newRow("wrap 1, next after 65535") << (quint16) 1 << (quint16) 1 << Q_INT64_C(65535) << Q_INT64_C(65536);
+    QTest::newRow("wrap 1, previous before 65536") << (quint16) 1 << (quint16) 65535 << Q_INT64_C(65536) << Q_INT64_C(65535);
+    QTest::newRow("wrap 1, ahead across") << (quint16) 1 << (quint16) 1 << Q_INT64_C(65530) << Q_INT64_C(65536);
+    QTest::newRow("wrap 1, third cycle") << (quint16) 1 << (quint16) 5 << Q_INT64_C(131070) << Q_INT64_C(131075);
+    /* The ACK of the request, wherever the transfer is */
+    QTest::newRow("wrap 1, request") << (quint16) 1 << (quint16) 0 << Q_INT64_C(65535) << Q_INT64_C(0);
+}
+
+void QTftpPacketTest::blockFromWire()
+{
+    QFETCH(quint16, wrap);
+    QFETCH(quint16, wire);
+    QFETCH(qint64, reference);
+    QFETCH(qint64, block);
+    QCOMPARE(QTftpPacket::blockFromWire(wire, reference, wrap), block);
+}
+
+void QTftpPacketTest::windowAcrossWrap_data()
+{
+    QTest::addColumn<quint16>("wrap");
+    QTest::addColumn<qint64>("first");
+    const qint64 firsts[] = { 1, 65520, 65530, 65535, 65536, 131060, 131070, Q_INT64_C(0x7fff0000) };
+    for (quint16 wrap = 0; wrap <= 1; wrap++) {
+        for (unsigned i = 0; i < sizeof(firsts) / sizeof(firsts[0]); i++)
+            QTest::newRow(qPrintable(QString("wrap %1, window at %2").arg(wrap).arg(firsts[i])))
+                    << wrap << firsts[i];
+    }
+}
+
+void QTftpPacketTest::windowAcrossWrap()
+{
+    /*
+     * A window of 64 blocks starting at first, as QTftp sees it: ACKs for
+     * every block of the window and for a few before it (duplicates) map
+     * back to the block that was sent.
+     */
+    QFETCH(quint16, wrap);
+    QFETCH(qint64, first);
+    for (qint64 block = qMax(Q_INT64_C(1), first - 8); block < first + 64; block++) {
+        const quint16 wire = QTftpPacket::wireBlock(block, wrap);
+        QVERIFY(wrap == 0 || wire != 0);
+        QCOMPARE(QTftpPacket::blockFromWire(wire, first, wrap), block);
+        /* The same from the receiver's side, which expects the next block */
+        QCOMPARE(QTftpPacket::blockFromWire(wire, block + 1, wrap) - (block + 1), Q_INT64_C(-1));
+    }
+}
+
+bool QTftpPacketTest::parsesInside(const QByteArray &datagram)
+{
+    /* Exactly as large as the datagram, nothing to read behind it */
+    char *exact = (char *) malloc(qMax(datagram.size(), 1));
+    memcpy(exact, datagram.constData(), datagram.size());
+    const bool inside = check(exact, datagram.size());
+    free(exact);
+    return inside;
+}
+
+bool QTftpPacketTest::check(const char *packet, int size)
+{
+    const char *end = packet + size;
+    quint16 number;
+    const char *payload;
+    int payloadSize;
+    if (QTftpPacket::parseData(packet, size, &number, &payload, &payloadSize)
+            && (payload < packet || payload + payloadSize > end))
+        return false;
+    QTftpPacketString message;
+    if (QTftpPacket::parseError(packet, size, &number, &message)
+            && (message.data < packet || message.data + message.size > end))
+        return false;
+    QTftpPacketString file;
+    QTftpPacketString mode;
+    int offset = 2;
+    if (QTftpPacket::parseRequest(packet, size, &file, &mode, &offset)
+            && (file.data + file.size >= end || mode.data + mode.size >= end || offset > size))
+        return false;
+    /* The same walk serves requests and OACKs */
+    QTftpPacketString name;
+    QTftpPacketString value;
+    int options = 0;
+    while (QTftpPacket::nextOption(packet, size, &offset, &name, &value)) {
+        /* Both are terminated inside the datagram */
+        if (name.size <= 0 || value.data + value.size >= end || offset > size || ++options > size)
+            return false;
+        quint64 parsed;
+        value.toNumber(Q_UINT64_C(0xffffffffffffffff), &parsed);
+        name.equals("blksize");
+    }
+    return true;
+}
+
+QTEST_APPLESS_MAIN(QTftpPacketTest)
+#include "tst_qtftppacket.moc"